@@ -0,0 +1,224 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.hpp"
+#include "thread_registry.hpp"
+
+namespace getrafty::concurrent {
+
+// Epoch-based memory reclamation (K. Fraser).
+//
+// Readers pin the domain for the duration of every access to shared nodes.
+// Writers retire unlinked nodes into a per-thread bucket tagged with the
+// global epoch; the epoch only advances once every pinned thread has
+// observed it, so a node retired at epoch E is unreachable by anyone once
+// the global epoch reaches E + 2 and is reclaimed then.
+//
+// Pinning costs a store and a fence on a thread-local record. Retirement
+// is a vector push; every kRetireBatch retirements the thread tags the
+// batch with the global epoch, tries to advance it (which scans all
+// records) and frees its expired buckets.
+//
+// A reader stalled inside a pinned section holds back reclamation of every
+// node retired since, use HazardDomain when that is a concern.
+class EpochDomain {
+  struct Record;
+
+ public:
+  static constexpr size_t kRetireBatch = 64;
+
+  // Keeps calling thread pinned while alive. Pins nest.
+  class Guard {
+   public:
+    // Non-copyable
+    Guard(const Guard&) = delete;
+
+    Guard& operator=(const Guard&) = delete;
+
+    Guard(Guard&& that) noexcept
+        : domain_(std::exchange(that.domain_, nullptr)),
+          record_(std::exchange(that.record_, nullptr)) {}
+
+    ~Guard() {
+      if (record_ != nullptr) {
+        domain_->unpin(*record_);
+      }
+    }
+
+   private:
+    friend class EpochDomain;
+
+    Guard(EpochDomain* domain, Record* record)
+        : domain_(domain), record_(record) {}
+
+    EpochDomain* domain_;
+    Record* record_;
+  };
+
+  EpochDomain()
+      : id_(detail::nextRegistryId()),
+        registry_(std::make_shared<detail::ThreadRegistry<Record>>()) {}
+
+  // Non-copyable
+  EpochDomain(const EpochDomain&) = delete;
+
+  EpochDomain& operator=(const EpochDomain&) = delete;
+
+  // Non-movable
+  EpochDomain(EpochDomain&&) = delete;
+
+  // No thread may be pinned at this point
+  ~EpochDomain() {
+    registry_->forEach([](Record& record) {
+      reclaimAll(record.pending_);
+      for (auto& bucket : record.limbo_) {
+        reclaimAll(bucket.retired);
+      }
+    });
+  }
+
+  // Process-wide domain shared by structures that don't need their own
+  static EpochDomain& global() {
+    static EpochDomain domain;
+    return domain;
+  }
+
+  [[nodiscard]] Guard pin() {
+    auto& record = local();
+    if (record.nesting_++ == 0) {
+      const auto epoch = epoch_.load(std::memory_order_relaxed);
+      record.state_.store(epoch << 1 | kActive, std::memory_order_relaxed);
+      // Pairs with the fence in tryAdvance: either the advancing thread
+      // sees this pin or this thread sees nodes unlinked before advance
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    return {this, &record};
+  }
+
+  // Node must already be unlinked. Deleter must not use the domain.
+  template <typename T>
+  void retire(T* ptr) {
+    retire(ptr, &detail::deleteAs<T>);
+  }
+
+  void retire(void* ptr, void (*deleter)(void*)) {
+    auto& record = local();
+    record.pending_.push_back({.ptr = ptr, .deleter = deleter});
+    if (record.pending_.size() >= kRetireBatch) {
+      seal(record);
+    }
+  }
+
+  // Tags whatever the calling thread retired so far, advances the epoch if
+  // possible and reclaims what is now safe to free
+  void collect() { seal(local()); }
+
+  [[nodiscard]] uint64_t epoch() const {
+    return epoch_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  static constexpr uint64_t kActive = 1;
+  static constexpr size_t kBuckets  = 3;
+
+  struct Bucket {
+    uint64_t epoch{0};
+    std::vector<detail::Retired> retired;
+  };
+
+  struct Record {
+    std::atomic<bool> in_use_{false};
+    Record* next_{nullptr};
+
+    // Pinned epoch shifted left by one, low bit is set while pinned
+    alignas(kCacheLineSize) std::atomic<uint64_t> state_{0};
+
+    // Owner only
+    uint32_t nesting_{0};
+    // Retired but not tagged with an epoch yet
+    std::vector<detail::Retired> pending_;
+    std::array<Bucket, kBuckets> limbo_;
+  };
+
+  Record& local() { return detail::localRecord(id_, registry_); }
+
+  void unpin(Record& record) {
+    if (--record.nesting_ == 0) {
+      record.state_.store(0, std::memory_order_release);
+    }
+  }
+
+  void seal(Record& record) {
+    // Every pending node was unlinked before this fence, so no thread
+    // pinning after it can reach them
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const auto epoch = epoch_.load(std::memory_order_relaxed);
+
+    auto& bucket = record.limbo_[epoch % kBuckets];
+    if (bucket.epoch != epoch) {
+      // Same slot was last tagged at least kBuckets epochs ago
+      reclaimAll(bucket.retired);
+      bucket.epoch = epoch;
+    }
+    bucket.retired.insert(bucket.retired.end(), record.pending_.begin(),
+                          record.pending_.end());
+    record.pending_.clear();
+
+    tryAdvance();
+    reclaimExpired(record);
+  }
+
+  bool tryAdvance() {
+    auto epoch = epoch_.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Everyone pinned must have observed the current epoch
+    bool lagging = false;
+    registry_->forEach([&](Record& record) {
+      // Acquire pairs with release in unpin: reads of a thread that left
+      // the pinned section happen before the nodes it saw are reclaimed
+      const auto state = record.state_.load(std::memory_order_acquire);
+      if ((state & kActive) != 0 && (state >> 1) != epoch) {
+        lagging = true;
+      }
+    });
+    if (lagging) {
+      return false;
+    }
+
+    return epoch_.compare_exchange_strong(epoch, epoch + 1,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed);
+  }
+
+  void reclaimExpired(Record& record) {
+    const auto epoch = epoch_.load(std::memory_order_acquire);
+    for (auto& bucket : record.limbo_) {
+      if (bucket.epoch + 2 <= epoch) {
+        reclaimAll(bucket.retired);
+      }
+    }
+  }
+
+  // Keeps vector capacity, so steady state retirement does not allocate
+  static void reclaimAll(std::vector<detail::Retired>& retired) {
+    for (const auto& item : retired) {
+      item.reclaim();
+    }
+    retired.clear();
+  }
+
+  const uint64_t id_;
+  std::shared_ptr<detail::ThreadRegistry<Record>> registry_;
+
+  alignas(kCacheLineSize) std::atomic<uint64_t> epoch_{0};
+};
+
+}  // namespace getrafty::concurrent
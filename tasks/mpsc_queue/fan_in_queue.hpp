@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.hpp"
+
+namespace getrafty::concurrent {
+
+namespace detail {
+inline uint64_t nextFanInQueueId() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+}  // namespace detail
+
+// Multi-producer/single-consumer queue sharded into per-producer lanes.
+//
+// Each producer thread lazily registers its own SPSC lane on first push,
+// so producers never write to a shared cache line on the hot path. The
+// consumer round-robins across lanes taking one item per lane visit.
+//
+// FIFO order is preserved per producer, there is no total order across
+// producers. Lane of an exited producer thread is handed over to the next
+// registering one, so memory is bounded by LaneCapacity * MaxLanes items.
+template <typename T, size_t LaneCapacity = 1024, size_t MaxLanes = 128>
+class FanInQueue {
+ public:
+  explicit FanInQueue() : id_(detail::nextFanInQueueId()) {}
+
+  // Non-copyable
+  FanInQueue(const FanInQueue&) = delete;
+
+  FanInQueue& operator=(const FanInQueue&) = delete;
+
+  // Non-movable
+  FanInQueue(FanInQueue&&) = delete;
+
+  ~FanInQueue() {
+    // Producer threads may keep their lanes alive past this point,
+    // release the items eagerly
+    for (const auto& lane : owners_) {
+      if (lane) {
+        while (lane->ring_.tryPop()) {
+        }
+      }
+    }
+  }
+
+  // Spins (yielding) while producer's lane is full
+  void push(T value) {
+    auto& ring = localLane().ring_;
+    while (!ring.tryPush(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+
+  // Value is left untouched if producer's lane is full
+  bool tryPush(T&& value) {
+    return localLane().ring_.tryPush(std::move(value));
+  }
+
+  std::optional<T> tryTake() {
+    const auto count = std::min(lane_count_.load(std::memory_order_acquire),
+                                MaxLanes);
+    if (next_lane_ >= count) {
+      next_lane_ = 0;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+      Lane* lane = lanes_[next_lane_].load(std::memory_order_acquire);
+      next_lane_ = next_lane_ + 1 == count ? 0 : next_lane_ + 1;
+      if (lane == nullptr) {
+        // Slot reserved but lane is not published yet
+        continue;
+      }
+      if (auto value = lane->ring_.tryPop()) {
+        return value;
+      }
+    }
+    return std::nullopt;
+  }
+
+  [[nodiscard]] size_t lanes() const {
+    return std::min(lane_count_.load(std::memory_order_acquire), MaxLanes);
+  }
+
+ private:
+  struct Lane {
+    SpscRing<T, LaneCapacity> ring_;
+    // Set while some producer thread owns the lane
+    std::atomic<bool> claimed_{true};
+  };
+
+  using LanePtr = std::shared_ptr<Lane>;
+
+  struct LocalLane {
+    uint64_t queue_id;
+    // Shared so that a producer thread outliving the queue can still
+    // release its lane on exit
+    LanePtr lane;
+  };
+
+  struct LocalLanes {
+    std::vector<LocalLane> lanes;
+
+    ~LocalLanes() {
+      for (const auto& local : lanes) {
+        // Publishes producer side of the ring to the next owner
+        local.lane->claimed_.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  Lane& localLane() {
+    // Keyed by queue id rather than address so a queue allocated at the
+    // address of a destroyed one never picks up its dangling lanes
+    thread_local LocalLanes local_lanes;
+    for (const auto& local : local_lanes.lanes) {
+      if (local.queue_id == id_) {
+        return *local.lane;
+      }
+    }
+
+    // Slow path: drop lanes of destroyed queues and register a new one
+    std::erase_if(local_lanes.lanes, [](const LocalLane& local) {
+      return local.lane.use_count() == 1;
+    });
+    auto lane = acquireLane();
+    local_lanes.lanes.push_back({.queue_id = id_, .lane = lane});
+    return *lane;
+  }
+
+  LanePtr acquireLane() {
+    const auto count = std::min(lane_count_.load(std::memory_order_acquire),
+                                MaxLanes);
+    for (size_t i = 0; i < count; ++i) {
+      Lane* lane = lanes_[i].load(std::memory_order_acquire);
+      if (lane == nullptr || lane->claimed_.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      bool expected = false;
+      if (lane->claimed_.compare_exchange_strong(expected, true,
+                                                 std::memory_order_acquire)) {
+        return owners_[i];
+      }
+    }
+
+    const auto index = lane_count_.fetch_add(1, std::memory_order_relaxed);
+    if (index >= MaxLanes) {
+      throw std::length_error("FanInQueue: too many producers");
+    }
+
+    auto lane      = std::make_shared<Lane>();
+    owners_[index] = lane;
+    lanes_[index].store(lane.get(), std::memory_order_release);
+    return lane;
+  }
+
+  const uint64_t id_;
+
+  // Written once per slot by the registering producer
+  std::array<LanePtr, MaxLanes> owners_;
+  std::array<std::atomic<Lane*>, MaxLanes> lanes_{};
+  std::atomic<size_t> lane_count_{0};
+
+  // Consumer only
+  alignas(kCacheLineSize) size_t next_lane_{0};
+};
+
+}  // namespace getrafty::concurrent
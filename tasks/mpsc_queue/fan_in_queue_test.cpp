@@ -0,0 +1,198 @@
+#include "fan_in_queue.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <latch>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace getrafty::concurrent;
+
+TEST(FanInQueueTest, BasicPushTake) {
+  FanInQueue<int> queue;
+
+  queue.push(42);
+  auto result = queue.tryTake();
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result.value(), 42);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TEST(FanInQueueTest, EmptyQueue) {
+  FanInQueue<int> queue;
+
+  EXPECT_FALSE(queue.tryTake().has_value());
+  EXPECT_EQ(queue.lanes(), 0);
+}
+
+TEST(FanInQueueTest, SingleProducerFifo) {
+  FanInQueue<int> queue;
+
+  for (int i = 0; i < 100; ++i) {
+    queue.push(i);
+  }
+
+  for (int i = 0; i < 100; ++i) {
+    auto result = queue.tryTake();
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result.value(), i);
+  }
+  EXPECT_EQ(queue.lanes(), 1);
+}
+
+TEST(FanInQueueTest, MoveOnlyType) {
+  FanInQueue<std::unique_ptr<int>> queue;
+
+  queue.push(std::make_unique<int>(42));
+
+  auto result = queue.tryTake();
+
+  ASSERT_TRUE(result.has_value());
+  ASSERT_NE(result.value(), nullptr);
+  EXPECT_EQ(*result.value(), 42);
+}
+
+TEST(FanInQueueTest, TryPushFailsWhenLaneFull) {
+  FanInQueue<std::string, 4> queue;
+
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(queue.tryPush(std::to_string(i)));
+  }
+
+  std::string overflow = "overflow";
+  EXPECT_FALSE(queue.tryPush(std::move(overflow)));
+  // Rejected value is not consumed
+  EXPECT_EQ(overflow, "overflow");
+
+  ASSERT_EQ(queue.tryTake().value(), "0");
+  EXPECT_TRUE(queue.tryPush(std::move(overflow)));
+}
+
+TEST(FanInQueueTest, LaneLimitExceeded) {
+  FanInQueue<int, 4, 1> queue;
+
+  queue.push(1);
+
+  std::thread producer(
+      [&]() { EXPECT_THROW(queue.push(2), std::length_error); });
+  producer.join();
+
+  EXPECT_EQ(queue.tryTake().value(), 1);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TEST(FanInQueueTest, RemainingItemsDestroyed) {
+  auto item = std::make_shared<int>(42);
+  {
+    FanInQueue<std::shared_ptr<int>> queue;
+    queue.push(item);
+    queue.push(item);
+    EXPECT_EQ(item.use_count(), 3);
+  }
+  EXPECT_EQ(item.use_count(), 1);
+}
+
+TEST(FanInQueueTest, LaneRecycledAfterProducerExit) {
+  FanInQueue<int, 4, 1> queue;
+
+  std::thread([&]() { queue.push(1); }).join();
+  std::thread([&]() { queue.push(2); }).join();
+
+  EXPECT_EQ(queue.lanes(), 1);
+  EXPECT_EQ(queue.tryTake().value(), 1);
+  EXPECT_EQ(queue.tryTake().value(), 2);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TEST(FanInQueueTest, ConsumerRoundRobinsAcrossLanes) {
+  FanInQueue<int> queue;
+
+  constexpr int kNumProducers     = 4;
+  constexpr int kItemsPerProducer = 10;
+
+  // Keep producers alive so that each one owns a distinct lane
+  std::latch pushed(kNumProducers);
+  std::latch checked(1);
+
+  std::vector<std::thread> producers;
+  producers.reserve(kNumProducers);
+
+  for (int p = 0; p < kNumProducers; ++p) {
+    producers.emplace_back([&queue, &pushed, &checked, p]() {
+      for (int i = 0; i < kItemsPerProducer; ++i) {
+        queue.push(p);
+      }
+      pushed.count_down();
+      checked.wait();
+    });
+  }
+
+  pushed.wait();
+  ASSERT_EQ(queue.lanes(), kNumProducers);
+
+  // Every window of kNumProducers takes visits each lane exactly once
+  for (int i = 0; i < kItemsPerProducer; ++i) {
+    std::vector<int> window;
+    for (int p = 0; p < kNumProducers; ++p) {
+      window.push_back(queue.tryTake().value());
+    }
+    std::sort(window.begin(), window.end());
+    EXPECT_EQ(window, (std::vector<int>{0, 1, 2, 3}));
+  }
+
+  checked.count_down();
+  for (auto& producer : producers) {
+    producer.join();
+  }
+}
+
+TEST(FanInQueueTest, ConcurrentPushTakePreservesPerProducerOrder) {
+  FanInQueue<int, 256> queue;
+
+  constexpr int kNumProducers     = 8;
+  constexpr int kItemsPerProducer = 10000;
+
+  std::vector<std::thread> producers;
+  producers.reserve(kNumProducers);
+
+  std::latch start_latch(kNumProducers + 1);
+
+  for (int p = 0; p < kNumProducers; ++p) {
+    producers.emplace_back([&queue, &start_latch, p]() {
+      start_latch.count_down();
+      start_latch.wait();
+
+      for (int i = 0; i < kItemsPerProducer; ++i) {
+        queue.push(p * kItemsPerProducer + i);
+      }
+    });
+  }
+
+  start_latch.count_down();
+  start_latch.wait();
+
+  std::vector<int> last_seen(kNumProducers, -1);
+  int consumed = 0;
+  while (consumed < kNumProducers * kItemsPerProducer) {
+    if (auto item = queue.tryTake()) {
+      const int producer = item.value() / kItemsPerProducer;
+      const int sequence = item.value() % kItemsPerProducer;
+      EXPECT_EQ(sequence, last_seen[producer] + 1);
+      last_seen[producer] = sequence;
+      ++consumed;
+    }
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  EXPECT_FALSE(queue.tryTake().has_value());
+  EXPECT_LE(queue.lanes(), kNumProducers);
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "spsc_ring.hpp"
+#include "thread_registry.hpp"
+
+namespace getrafty::concurrent {
+
+// Hazard pointers (M. Michael).
+//
+// A reader publishes every node it is about to dereference in one of its
+// hazard slots; a retired node is only reclaimed once no slot holds it.
+// Unlike EpochDomain, a stalled reader keeps alive just the nodes it has
+// published, so the amount of unreclaimed memory stays bounded no matter
+// how long readers take.
+//
+// Retired nodes collect in a per-thread list which is scanned against all
+// published hazards once it grows past a threshold proportional to the
+// total number of slots, so the scan cost is amortized over many retires.
+class HazardDomain {
+  struct Record;
+
+ public:
+  static constexpr size_t kSlotsPerThread   = 4;
+  static constexpr size_t kMinScanThreshold = 64;
+
+  // Owns one hazard slot of the calling thread while alive
+  class HazardPointer {
+   public:
+    // Non-copyable
+    HazardPointer(const HazardPointer&) = delete;
+
+    HazardPointer& operator=(const HazardPointer&) = delete;
+
+    HazardPointer(HazardPointer&& that) noexcept
+        : record_(std::exchange(that.record_, nullptr)), slot_(that.slot_) {}
+
+    ~HazardPointer() {
+      if (record_ != nullptr) {
+        reset();
+        record_->free_slots_ |= 1u << slot_;
+      }
+    }
+
+    // Loads 'src' and keeps the loaded node safe to dereference until the
+    // next protect/reset, even if it gets unlinked and retired meanwhile
+    template <typename T>
+    T* protect(const std::atomic<T*>& src) {
+      T* ptr = src.load(std::memory_order_relaxed);
+      while (true) {
+        record_->slots_[slot_].store(ptr, std::memory_order_relaxed);
+        // Pairs with the fence in scan: either the scan sees this hazard
+        // or this thread sees the unlink that preceded retirement
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        T* current = src.load(std::memory_order_acquire);
+        if (current == ptr) {
+          return ptr;
+        }
+        ptr = current;
+      }
+    }
+
+    void reset() {
+      record_->slots_[slot_].store(nullptr, std::memory_order_release);
+    }
+
+   private:
+    friend class HazardDomain;
+
+    HazardPointer(Record* record, uint32_t slot)
+        : record_(record), slot_(slot) {}
+
+    Record* record_;
+    uint32_t slot_;
+  };
+
+  HazardDomain()
+      : id_(detail::nextRegistryId()),
+        registry_(std::make_shared<detail::ThreadRegistry<Record>>()) {}
+
+  // Non-copyable
+  HazardDomain(const HazardDomain&) = delete;
+
+  HazardDomain& operator=(const HazardDomain&) = delete;
+
+  // Non-movable
+  HazardDomain(HazardDomain&&) = delete;
+
+  // No hazard pointer may be alive at this point
+  ~HazardDomain() {
+    registry_->forEach([](Record& record) {
+      for (const auto& item : record.retired_) {
+        item.reclaim();
+      }
+      record.retired_.clear();
+    });
+  }
+
+  // Process-wide domain shared by structures that don't need their own
+  static HazardDomain& global() {
+    static HazardDomain domain;
+    return domain;
+  }
+
+  // Throws std::length_error if calling thread holds kSlotsPerThread already
+  [[nodiscard]] HazardPointer makeHazardPointer() {
+    auto& record = local();
+    if (record.free_slots_ == 0) {
+      throw std::length_error("HazardDomain: out of hazard slots");
+    }
+    const auto slot =
+        static_cast<uint32_t>(std::countr_zero(record.free_slots_));
+    record.free_slots_ &= ~(1u << slot);
+    return {&record, slot};
+  }
+
+  // Node must already be unlinked. Deleter must not use the domain.
+  template <typename T>
+  void retire(T* ptr) {
+    retire(ptr, &detail::deleteAs<T>);
+  }
+
+  void retire(void* ptr, void (*deleter)(void*)) {
+    auto& record = local();
+    record.retired_.push_back({.ptr = ptr, .deleter = deleter});
+    if (record.retired_.size() >= scanThreshold()) {
+      scan(record);
+    }
+  }
+
+  // Reclaims every node the calling thread retired that is not protected
+  void collect() { scan(local()); }
+
+ private:
+  static constexpr uint32_t kAllSlots = (1u << kSlotsPerThread) - 1;
+
+  struct Record {
+    std::atomic<bool> in_use_{false};
+    Record* next_{nullptr};
+
+    alignas(kCacheLineSize) std::array<std::atomic<void*>, kSlotsPerThread>
+        slots_{};
+
+    // Owner only
+    uint32_t free_slots_{kAllSlots};
+    std::vector<detail::Retired> retired_;
+    std::vector<void*> hazards_;
+  };
+
+  Record& local() { return detail::localRecord(id_, registry_); }
+
+  // Scanning at a multiple of the number of slots guarantees that at least
+  // half of the list is reclaimed by every scan
+  size_t scanThreshold() const {
+    return std::max(kMinScanThreshold,
+                    2 * kSlotsPerThread * registry_->size());
+  }
+
+  void scan(Record& record) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto& hazards = record.hazards_;
+    hazards.clear();
+    registry_->forEach([&](Record& other) {
+      for (const auto& slot : other.slots_) {
+        // Acquire pairs with release in reset: reads through a hazard
+        // happen before the node is reclaimed
+        if (void* ptr = slot.load(std::memory_order_acquire)) {
+          hazards.push_back(ptr);
+        }
+      }
+    });
+    std::sort(hazards.begin(), hazards.end());
+
+    // Protected nodes are kept for the next scan
+    auto unprotected = std::partition(
+        record.retired_.begin(), record.retired_.end(),
+        [&](const detail::Retired& item) {
+          return std::binary_search(hazards.begin(), hazards.end(), item.ptr);
+        });
+    for (auto it = unprotected; it != record.retired_.end(); ++it) {
+      it->reclaim();
+    }
+    record.retired_.erase(unprotected, record.retired_.end());
+  }
+
+  const uint64_t id_;
+  std::shared_ptr<detail::ThreadRegistry<Record>> registry_;
+};
+
+}  // namespace getrafty::concurrent
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <limits>
+#include <optional>
+
+namespace getrafty::concurrent {
+
+namespace detail {
+inline timespec* toTimespec(std::optional<std::chrono::nanoseconds> timeout,
+                            timespec& ts) {
+  if (!timeout) {
+    return nullptr;
+  }
+  const auto ns = std::max(timeout->count(), int64_t{0});
+  ts.tv_sec     = static_cast<time_t>(ns / 1'000'000'000);
+  ts.tv_nsec    = static_cast<long>(ns % 1'000'000'000);
+  return &ts;
+}
+
+inline long futexWait(std::atomic<uint32_t>& word, uint32_t expected,
+                      const timespec* timeout) {
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+  return ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word),
+                   FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+inline void futexWake(std::atomic<uint32_t>& word, int count) {
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE,
+            count, nullptr, nullptr, 0);
+}
+}  // namespace detail
+
+// Parking spot for a single waiter built on top of futex(2).
+//
+// Waiter announces its intent to sleep with 'prepare', re-checks its wait
+// condition and only then calls 'park'. Signaller publishes its change and
+// calls 'unpark', which costs a single load unless the waiter actually
+// announced itself, so non-contended signalling stays syscall-free.
+//
+//   waiter                         signaller
+//   ------                         ---------
+//   prepare()                      <publish>
+//   if (<condition>) cancel()      unpark()
+//   else park()
+//
+class Parker {
+ public:
+  Parker() = default;
+
+  // Non-copyable
+  Parker(const Parker&) = delete;
+
+  Parker& operator=(const Parker&) = delete;
+
+  // Non-movable
+  Parker(Parker&&) = delete;
+
+  ~Parker() = default;
+
+  void prepare() {
+    state_.store(kParked, std::memory_order_relaxed);
+    // Pairs with the fence in 'unpark': either signaller observes kParked
+    // or waiter observes the published change when re-checking.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  void cancel() { state_.store(kIdle, std::memory_order_relaxed); }
+
+  // Returns false if woken up by timeout rather than by 'unpark'
+  bool park(std::optional<std::chrono::nanoseconds> timeout = std::nullopt) {
+    // Retries wait out what is left, not the whole timeout again
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    if (timeout) {
+      deadline = std::chrono::steady_clock::now() + *timeout;
+    }
+
+    while (state_.load(std::memory_order_acquire) == kParked) {
+      timespec ts{};
+      const timespec* tsp = nullptr;
+      if (deadline) {
+        const auto remaining = *deadline - std::chrono::steady_clock::now();
+        if (remaining <= std::chrono::steady_clock::duration::zero()) {
+          return timedOut();
+        }
+        tsp = detail::toTimespec(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(remaining),
+            ts);
+      }
+      const auto rc = detail::futexWait(state_, kParked, tsp);
+      if (rc == -1 && errno == ETIMEDOUT) {
+        return timedOut();
+      }
+      // EINTR, EAGAIN or wakeup: re-check state
+    }
+    return true;
+  }
+
+  void unpark() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    // Fast path: nobody is parked, avoid RMW on a shared cache line
+    if (state_.load(std::memory_order_relaxed) != kParked) {
+      return;
+    }
+    if (state_.exchange(kIdle, std::memory_order_acq_rel) == kParked) {
+      detail::futexWake(state_, 1);
+    }
+  }
+
+ private:
+  static constexpr uint32_t kIdle   = 0;
+  static constexpr uint32_t kParked = 1;
+
+  bool timedOut() {
+    // Signaller may have raced with the timeout, consume its wakeup
+    return state_.exchange(kIdle, std::memory_order_acq_rel) != kParked;
+  }
+
+  std::atomic<uint32_t> state_{kIdle};
+};
+
+// Multi-waiter counterpart of Parker.
+//
+// Waiter takes a key with 'prepare', re-checks its wait condition and then
+// either calls 'cancel' or blocks in 'wait' until the key goes stale.
+// Signaller bumps the epoch and issues futex wake only when someone has
+// announced itself as waiting.
+class EventCount {
+ public:
+  using Key = uint32_t;
+
+  EventCount() = default;
+
+  // Non-copyable
+  EventCount(const EventCount&) = delete;
+
+  EventCount& operator=(const EventCount&) = delete;
+
+  // Non-movable
+  EventCount(EventCount&&) = delete;
+
+  ~EventCount() = default;
+
+  Key prepare() {
+    waiters_.fetch_add(1, std::memory_order_relaxed);
+    const auto key = epoch_.load(std::memory_order_relaxed);
+    // Pairs with the fence in 'notify': either signaller observes the waiter
+    // or waiter observes the published change when re-checking. The RMW on
+    // its own orders nothing against the re-check, which need not be
+    // seq_cst.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return key;
+  }
+
+  void cancel() { waiters_.fetch_sub(1, std::memory_order_relaxed); }
+
+  // Returns false if woken up by timeout
+  bool wait(Key key,
+            std::optional<std::chrono::nanoseconds> timeout = std::nullopt) {
+    timespec ts{};
+    const auto rc =
+        detail::futexWait(epoch_, key, detail::toTimespec(timeout, ts));
+    const bool timed_out = rc == -1 && errno == ETIMEDOUT;
+    waiters_.fetch_sub(1, std::memory_order_relaxed);
+    return !timed_out;
+  }
+
+  void notifyOne() { notify(1); }
+
+  void notifyAll() { notify(std::numeric_limits<int>::max()); }
+
+ private:
+  void notify(int count) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_relaxed) == 0) {
+      return;
+    }
+    epoch_.fetch_add(1, std::memory_order_release);
+    detail::futexWake(epoch_, count);
+  }
+
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> waiters_{0};
+};
+
+}  // namespace getrafty::concurrent
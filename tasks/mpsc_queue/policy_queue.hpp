@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "parker.hpp"
+#include "queue_storage.hpp"
+#include "spsc_ring.hpp"
+
+namespace getrafty::concurrent {
+
+enum class Arity : uint8_t { Single, Multi };
+
+enum class Wait : uint8_t { NonBlocking, Blocking };
+
+enum class Padding : uint8_t { Packed, CacheLine };
+
+// Unbounded queue if Capacity is zero
+inline constexpr size_t kUnbounded = 0;
+
+template <size_t Capacity = kUnbounded, Arity Producers = Arity::Multi,
+          Arity Consumers = Arity::Single, Wait WaitMode = Wait::NonBlocking,
+          Padding Pad = Padding::CacheLine>
+struct QueuePolicy {
+  static constexpr size_t kCapacity = Capacity;
+  static constexpr bool kBounded    = Capacity != kUnbounded;
+  static constexpr Arity kProducers = Producers;
+  static constexpr Arity kConsumers = Consumers;
+  static constexpr bool kBlocking   = WaitMode == Wait::Blocking;
+  static constexpr bool kPadded     = Pad == Padding::CacheLine;
+};
+
+namespace detail {
+
+template <typename T, typename Policy>
+struct StorageFor {
+  static constexpr bool kMultiProducer = Policy::kProducers == Arity::Multi;
+  static constexpr bool kMultiConsumer = Policy::kConsumers == Arity::Multi;
+
+  using Bounded = std::conditional_t<
+      !kMultiProducer && !kMultiConsumer,
+      SpscRing<T, Policy::kCapacity, Policy::kPadded>,
+      SequencedRing<T, Policy::kCapacity, kMultiProducer, kMultiConsumer,
+                    Policy::kPadded>>;
+
+  using Unbounded = std::conditional_t<
+      kMultiConsumer, LinkedMpmc<T, Policy::kPadded>,
+      std::conditional_t<kMultiProducer, LinkedMpsc<T, Policy::kPadded>,
+                         LinkedSpsc<T, Policy::kPadded>>>;
+
+  using Type = std::conditional_t<Policy::kBounded, Bounded, Unbounded>;
+};
+
+// Uniform view over Parker (one waiter) and EventCount (many waiters)
+template <Arity Waiters>
+class Signal;
+
+template <>
+class Signal<Arity::Single> {
+ public:
+  using Key = uint32_t;
+
+  Key prepare() {
+    parker_.prepare();
+    return 0;
+  }
+
+  void cancel() { parker_.cancel(); }
+
+  bool wait(Key /*key*/, std::optional<std::chrono::nanoseconds> timeout) {
+    return parker_.park(timeout);
+  }
+
+  void notify() { parker_.unpark(); }
+
+ private:
+  Parker parker_;
+};
+
+template <>
+class Signal<Arity::Multi> {
+ public:
+  using Key = EventCount::Key;
+
+  Key prepare() { return event_count_.prepare(); }
+
+  void cancel() { event_count_.cancel(); }
+
+  bool wait(Key key, std::optional<std::chrono::nanoseconds> timeout) {
+    return event_count_.wait(key, timeout);
+  }
+
+  void notify() { event_count_.notifyOne(); }
+
+ private:
+  EventCount event_count_;
+};
+
+// Stateless stand-in for non-blocking queues
+struct NoSignal {
+  void notify() {}
+};
+
+}  // namespace detail
+
+// Queue family configured at compile time by QueuePolicy.
+//
+// Every policy resolves to a dedicated storage backend:
+//
+//   bounded,   1P/1C  -> SpscRing
+//   bounded,   other  -> SequencedRing (CAS only on the 'multi' side)
+//   unbounded, 1P/1C  -> LinkedSpsc
+//   unbounded, nP/1C  -> LinkedMpsc
+//   unbounded, xP/nC  -> LinkedMpmc (epoch-based reclamation)
+//
+// Blocking policies add futex-backed waiting on top of the same backend:
+// 'take' parks consumers while empty and 'push' parks producers while full.
+// Signalling side pays a fence and a load unless someone is parked.
+template <typename T, typename Policy = QueuePolicy<>>
+class PolicyQueue {
+ public:
+  using Storage = typename detail::StorageFor<T, Policy>::Type;
+
+  PolicyQueue() = default;
+
+  // Non-copyable
+  PolicyQueue(const PolicyQueue&) = delete;
+
+  PolicyQueue& operator=(const PolicyQueue&) = delete;
+
+  // Non-movable
+  PolicyQueue(PolicyQueue&&) = delete;
+
+  ~PolicyQueue() = default;
+
+  // Value is left untouched if queue is full
+  bool tryPush(T&& value) {
+    if (!storage_.tryPush(std::move(value))) {
+      return false;
+    }
+    not_empty_.notify();
+    return true;
+  }
+
+  // Never fails for unbounded queues, waits for space for blocking ones
+  void push(T value)
+    requires(!Policy::kBounded || Policy::kBlocking)
+  {
+    if constexpr (!Policy::kBounded) {
+      tryPush(std::move(value));
+    } else {
+      while (!tryPush(std::move(value))) {
+        const auto key = not_full_.prepare();
+        if (tryPush(std::move(value))) {
+          not_full_.cancel();
+          return;
+        }
+        not_full_.wait(key, std::nullopt);
+      }
+    }
+  }
+
+  std::optional<T> tryTake() {
+    auto value = storage_.tryPop();
+    if (value) {
+      not_full_.notify();
+    }
+    return value;
+  }
+
+  T take()
+    requires(Policy::kBlocking)
+  {
+    while (true) {
+      if (auto value = tryTake()) {
+        return std::move(*value);
+      }
+      const auto key = not_empty_.prepare();
+      if (auto value = tryTake()) {
+        not_empty_.cancel();
+        return std::move(*value);
+      }
+      not_empty_.wait(key, std::nullopt);
+    }
+  }
+
+  template <typename Rep, typename Period>
+  std::optional<T> takeFor(std::chrono::duration<Rep, Period> timeout)
+    requires(Policy::kBlocking)
+  {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+      if (auto value = tryTake()) {
+        return value;
+      }
+      const auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining <= std::chrono::steady_clock::duration::zero()) {
+        return std::nullopt;
+      }
+      const auto key = not_empty_.prepare();
+      if (auto value = tryTake()) {
+        not_empty_.cancel();
+        return value;
+      }
+      not_empty_.wait(key, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               remaining));
+    }
+  }
+
+ private:
+  using NotEmpty = std::conditional_t<Policy::kBlocking,
+                                      detail::Signal<Policy::kConsumers>,
+                                      detail::NoSignal>;
+  using NotFull =
+      std::conditional_t<Policy::kBlocking && Policy::kBounded,
+                         detail::Signal<Policy::kProducers>, detail::NoSignal>;
+
+  // Keep waiter words off the storage cache lines, if there are any
+  template <typename S>
+  static constexpr size_t kSignalAlignment =
+      std::is_empty_v<S>
+          ? alignof(S)
+          : std::max(alignof(S), kIndexAlignment<Policy::kPadded>);
+
+  Storage storage_;
+  alignas(kSignalAlignment<NotEmpty>)
+      [[no_unique_address]] NotEmpty not_empty_;
+  alignas(kSignalAlignment<NotFull>) [[no_unique_address]] NotFull not_full_;
+};
+
+}  // namespace getrafty::concurrent
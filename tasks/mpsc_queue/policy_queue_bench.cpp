@@ -0,0 +1,127 @@
+#include "policy_queue.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <latch>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace getrafty::concurrent;
+
+namespace {
+
+constexpr size_t kBenchCapacity = 1024;
+constexpr int kBenchThreads     = 4;
+constexpr int kBenchItems       = 1 << 18;
+
+// Bit I of the index selects the I-th policy dimension
+template <size_t I>
+using PolicyAt = QueuePolicy<(I & 1) ? kBenchCapacity : kUnbounded,
+                             (I & 2) ? Arity::Multi : Arity::Single,
+                             (I & 4) ? Arity::Multi : Arity::Single,
+                             (I & 8) ? Wait::Blocking : Wait::NonBlocking,
+                             (I & 16) ? Padding::CacheLine : Padding::Packed>;
+
+template <typename Policy>
+std::string policyName() {
+  std::string name = Policy::kBounded ? "Bounded" : "Unbounded";
+  name += Policy::kProducers == Arity::Multi ? "/MP" : "/SP";
+  name += Policy::kConsumers == Arity::Multi ? "MC" : "SC";
+  name += Policy::kBlocking ? "/Blocking" : "/NonBlocking";
+  name += Policy::kPadded ? "/Padded" : "/Packed";
+  return name;
+}
+
+template <typename Policy>
+void produce(PolicyQueue<int, Policy>& queue, int value) {
+  if constexpr (!Policy::kBounded || Policy::kBlocking) {
+    queue.push(value);
+  } else {
+    while (!queue.tryPush(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+template <typename Policy>
+int64_t consume(PolicyQueue<int, Policy>& queue) {
+  if constexpr (Policy::kBlocking) {
+    return queue.take();
+  } else {
+    while (true) {
+      if (auto value = queue.tryTake()) {
+        return *value;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Producers and consumers run concurrently and hand over kBenchItems
+// items in total, so each cell of the matrix measures transfer throughput
+template <typename Policy>
+void BM_PolicyQueue(benchmark::State& state) {
+  constexpr int kProducers =
+      Policy::kProducers == Arity::Multi ? kBenchThreads : 1;
+  constexpr int kConsumers =
+      Policy::kConsumers == Arity::Multi ? kBenchThreads : 1;
+
+  PolicyQueue<int, Policy> queue;
+
+  for (auto _ : state) {
+    std::latch start_latch(kProducers + kConsumers + 1);
+
+    std::vector<std::thread> threads;
+    threads.reserve(kProducers + kConsumers);
+
+    for (int p = 0; p < kProducers; ++p) {
+      threads.emplace_back([&]() {
+        start_latch.arrive_and_wait();
+        for (int i = 0; i < kBenchItems / kProducers; ++i) {
+          produce(queue, i);
+        }
+      });
+    }
+
+    for (int c = 0; c < kConsumers; ++c) {
+      threads.emplace_back([&]() {
+        start_latch.arrive_and_wait();
+        int64_t sum = 0;
+        for (int i = 0; i < kBenchItems / kConsumers; ++i) {
+          sum += consume(queue);
+        }
+        benchmark::DoNotOptimize(sum);
+      });
+    }
+
+    start_latch.arrive_and_wait();
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBenchItems);
+}
+
+template <size_t... Is>
+bool registerPolicyMatrix(std::index_sequence<Is...>) {
+  (benchmark::RegisterBenchmark(
+       ("BM_PolicyQueue/" + policyName<PolicyAt<Is>>()).c_str(),
+       BM_PolicyQueue<PolicyAt<Is>>)
+       ->UseRealTime()
+       ->Unit(benchmark::kMillisecond),
+   ...);
+  return true;
+}
+
+// Every combination of bounded x producers x consumers x wait x padding
+const bool kPolicyMatrixRegistered =
+    registerPolicyMatrix(std::make_index_sequence<32>{});
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,271 @@
+#include "policy_queue.hpp"
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <latch>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace getrafty::concurrent;
+
+namespace {
+
+constexpr size_t kTestCapacity = 64;
+
+// Bit I of the index selects the I-th policy dimension
+template <size_t I>
+using PolicyAt = QueuePolicy<(I & 1) ? kTestCapacity : kUnbounded,
+                             (I & 2) ? Arity::Multi : Arity::Single,
+                             (I & 4) ? Arity::Multi : Arity::Single,
+                             (I & 8) ? Wait::Blocking : Wait::NonBlocking,
+                             (I & 16) ? Padding::CacheLine : Padding::Packed>;
+
+template <size_t... Is>
+::testing::Types<PolicyAt<Is>...> allPolicies(std::index_sequence<Is...>);
+
+using AllPolicies = decltype(allPolicies(std::make_index_sequence<32>{}));
+
+struct PolicyName {
+  template <typename Policy>
+  static std::string GetName(int /*index*/) {
+    std::string name = Policy::kBounded ? "Bounded" : "Unbounded";
+    name += Policy::kProducers == Arity::Multi ? "_MP" : "_SP";
+    name += Policy::kConsumers == Arity::Multi ? "MC" : "SC";
+    name += Policy::kBlocking ? "_Blocking" : "_NonBlocking";
+    name += Policy::kPadded ? "_Padded" : "_Packed";
+    return name;
+  }
+};
+
+template <typename Policy>
+void pushOrYield(PolicyQueue<int, Policy>& queue, int value) {
+  while (!queue.tryPush(std::move(value))) {
+    std::this_thread::yield();
+  }
+}
+
+template <typename Policy>
+int takeOrYield(PolicyQueue<int, Policy>& queue) {
+  if constexpr (Policy::kBlocking) {
+    return queue.take();
+  } else {
+    while (true) {
+      if (auto value = queue.tryTake()) {
+        return *value;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+}  // namespace
+
+template <typename Policy>
+class PolicyQueueTest : public ::testing::Test {};
+
+TYPED_TEST_SUITE(PolicyQueueTest, AllPolicies, PolicyName);
+
+TYPED_TEST(PolicyQueueTest, EmptyQueue) {
+  PolicyQueue<int, TypeParam> queue;
+
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TYPED_TEST(PolicyQueueTest, PushTakeFifo) {
+  PolicyQueue<int, TypeParam> queue;
+
+  for (int i = 0; i < 32; ++i) {
+    ASSERT_TRUE(queue.tryPush(int{i}));
+  }
+
+  for (int i = 0; i < 32; ++i) {
+    auto result = queue.tryTake();
+    ASSERT_TRUE(result.has_value());
+    EXPECT_EQ(result.value(), i);
+  }
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TYPED_TEST(PolicyQueueTest, MoveOnlyType) {
+  PolicyQueue<std::unique_ptr<int>, TypeParam> queue;
+
+  ASSERT_TRUE(queue.tryPush(std::make_unique<int>(42)));
+
+  auto result = queue.tryTake();
+
+  ASSERT_TRUE(result.has_value());
+  ASSERT_NE(result.value(), nullptr);
+  EXPECT_EQ(*result.value(), 42);
+}
+
+TYPED_TEST(PolicyQueueTest, RemainingItemsDestroyed) {
+  auto item = std::make_shared<int>(42);
+  {
+    PolicyQueue<std::shared_ptr<int>, TypeParam> queue;
+    ASSERT_TRUE(queue.tryPush(std::shared_ptr<int>(item)));
+    ASSERT_TRUE(queue.tryPush(std::shared_ptr<int>(item)));
+    EXPECT_EQ(item.use_count(), 3);
+  }
+  EXPECT_EQ(item.use_count(), 1);
+}
+
+TYPED_TEST(PolicyQueueTest, RejectsWhenFull) {
+  if constexpr (!TypeParam::kBounded) {
+    GTEST_SKIP() << "Unbounded queue is never full";
+  } else {
+    PolicyQueue<std::string, TypeParam> queue;
+
+    for (size_t i = 0; i < kTestCapacity; ++i) {
+      ASSERT_TRUE(queue.tryPush(std::to_string(i)));
+    }
+
+    std::string overflow = "overflow";
+    EXPECT_FALSE(queue.tryPush(std::move(overflow)));
+    // Rejected value is not consumed
+    EXPECT_EQ(overflow, "overflow");
+
+    EXPECT_EQ(queue.tryTake().value(), "0");
+    EXPECT_TRUE(queue.tryPush(std::move(overflow)));
+  }
+}
+
+TYPED_TEST(PolicyQueueTest, TakeForTimesOut) {
+  if constexpr (!TypeParam::kBlocking) {
+    GTEST_SKIP() << "Non-blocking queue";
+  } else {
+    PolicyQueue<int, TypeParam> queue;
+
+    const auto start  = std::chrono::steady_clock::now();
+    auto result       = queue.takeFor(std::chrono::milliseconds(20));
+    const auto waited = std::chrono::steady_clock::now() - start;
+
+    EXPECT_FALSE(result.has_value());
+    EXPECT_GE(waited, std::chrono::milliseconds(20));
+  }
+}
+
+TYPED_TEST(PolicyQueueTest, TakeForKeepsDeadlineWhenInterrupted) {
+  if constexpr (!TypeParam::kBlocking) {
+    GTEST_SKIP() << "Non-blocking queue";
+  } else {
+    PolicyQueue<int, TypeParam> queue;
+
+    // Handler without SA_RESTART, so every signal ends the futex wait
+    struct sigaction action {};
+    action.sa_handler = [](int) {};
+    struct sigaction previous {};
+    ASSERT_EQ(::sigaction(SIGUSR1, &action, &previous), 0);
+
+    std::atomic<bool> done{false};
+    std::chrono::steady_clock::duration waited{};
+    std::thread consumer([&]() {
+      const auto start = std::chrono::steady_clock::now();
+      EXPECT_FALSE(queue.takeFor(std::chrono::milliseconds(50)).has_value());
+      waited = std::chrono::steady_clock::now() - start;
+      done.store(true);
+    });
+
+    // Interrupts more often than the timeout, for longer than it
+    const auto give_up =
+        std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while (!done.load() && std::chrono::steady_clock::now() < give_up) {
+      ::pthread_kill(consumer.native_handle(), SIGUSR1);
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    consumer.join();
+    ::sigaction(SIGUSR1, &previous, nullptr);
+
+    EXPECT_GE(waited, std::chrono::milliseconds(50));
+    EXPECT_LT(waited, std::chrono::seconds(1));
+  }
+}
+
+TYPED_TEST(PolicyQueueTest, TakeBlocksUntilPush) {
+  if constexpr (!TypeParam::kBlocking) {
+    GTEST_SKIP() << "Non-blocking queue";
+  } else {
+    PolicyQueue<int, TypeParam> queue;
+
+    std::thread producer([&]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      queue.push(7);
+    });
+
+    EXPECT_EQ(queue.take(), 7);
+
+    producer.join();
+  }
+}
+
+TYPED_TEST(PolicyQueueTest, PushBlocksUntilSpace) {
+  if constexpr (!TypeParam::kBlocking || !TypeParam::kBounded) {
+    GTEST_SKIP() << "Push never waits";
+  } else {
+    PolicyQueue<int, TypeParam> queue;
+
+    for (size_t i = 0; i < kTestCapacity; ++i) {
+      queue.push(static_cast<int>(i));
+    }
+
+    std::atomic<bool> pushed{false};
+    std::thread producer([&]() {
+      queue.push(-1);
+      pushed.store(true, std::memory_order_release);
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(pushed.load(std::memory_order_acquire));
+
+    EXPECT_EQ(queue.take(), 0);
+    producer.join();
+    EXPECT_TRUE(pushed.load(std::memory_order_acquire));
+  }
+}
+
+TYPED_TEST(PolicyQueueTest, ConcurrentProducersConsumers) {
+  PolicyQueue<int, TypeParam> queue;
+
+  constexpr int kNumProducers = TypeParam::kProducers == Arity::Multi ? 4 : 1;
+  constexpr int kNumConsumers = TypeParam::kConsumers == Arity::Multi ? 4 : 1;
+  constexpr int kTotalItems   = 20000;
+
+  std::latch start_latch(kNumProducers + kNumConsumers);
+  std::atomic<int64_t> consumed_sum{0};
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kNumProducers; ++p) {
+    threads.emplace_back([&, p]() {
+      start_latch.arrive_and_wait();
+      for (int i = p; i < kTotalItems; i += kNumProducers) {
+        pushOrYield(queue, i);
+      }
+    });
+  }
+
+  for (int c = 0; c < kNumConsumers; ++c) {
+    threads.emplace_back([&]() {
+      start_latch.arrive_and_wait();
+      int64_t sum = 0;
+      for (int i = 0; i < kTotalItems / kNumConsumers; ++i) {
+        sum += takeOrYield(queue);
+      }
+      consumed_sum.fetch_add(sum, std::memory_order_relaxed);
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(consumed_sum.load(),
+            static_cast<int64_t>(kTotalItems) * (kTotalItems - 1) / 2);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
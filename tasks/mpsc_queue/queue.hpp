@@ -1,5 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <utility>
+
+#include "parker.hpp"
+
 // ==== YOUR CODE: @138b ====
 #include <optional>
 // ==== END YOUR CODE ====
@@ -24,6 +29,8 @@ class Queue {
     // ==== YOUR CODE: @b270 ====
 
     // ==== END YOUR CODE ====
+
+    parker_.unpark();
   }
 
   std::optional<T> tryTake() {
@@ -32,7 +39,47 @@ class Queue {
     // ==== END YOUR CODE ====
   }
 
+  // Blocks consumer until value is available
+  T take() {
+    while (true) {
+      if (auto value = tryTake()) {
+        return std::move(*value);
+      }
+      parker_.prepare();
+      if (auto value = tryTake()) {
+        parker_.cancel();
+        return std::move(*value);
+      }
+      parker_.park();
+    }
+  }
+
+  // Blocks consumer until value is available or timeout expires
+  template <typename Rep, typename Period>
+  std::optional<T> takeFor(std::chrono::duration<Rep, Period> timeout) {
+    const auto deadline = std::chrono::steady_clock::now() + timeout;
+    while (true) {
+      if (auto value = tryTake()) {
+        return value;
+      }
+      const auto remaining = deadline - std::chrono::steady_clock::now();
+      if (remaining <= std::chrono::steady_clock::duration::zero()) {
+        return std::nullopt;
+      }
+      parker_.prepare();
+      if (auto value = tryTake()) {
+        parker_.cancel();
+        return value;
+      }
+      parker_.park(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(remaining));
+    }
+  }
+
  private:
+  // Wakes up consumer blocked in 'take' or 'takeFor'
+  Parker parker_;
+
   // ==== YOUR CODE: @be49 ====
 
   // ==== END YOUR CODE ====
@@ -1,3 +1,4 @@
+#include "fan_in_queue.hpp"
 #include "queue.hpp"
 
 #include <benchmark/benchmark.h>
@@ -8,12 +9,13 @@
 
 using namespace getrafty::concurrent;
 
-static void BM_MultipleProducers(benchmark::State& state) {
+template <typename QueueT>
+static void runMultipleProducers(benchmark::State& state) {
   const auto num_producers      = static_cast<size_t>(state.range(0));
   const auto items_per_producer = static_cast<size_t>(state.range(1));
   const auto total_items        = num_producers * items_per_producer;
 
-  Queue<int> queue;
+  QueueT queue;
 
   for (auto _ : state) {
     std::latch start_latch(static_cast<ptrdiff_t>(num_producers + 1));
@@ -56,6 +58,15 @@ static void BM_MultipleProducers(benchmark::State& state) {
   }
 }
 
+static void BM_MultipleProducers(benchmark::State& state) {
+  runMultipleProducers<Queue<int>>(state);
+}
+
+static void BM_FanInMultipleProducers(benchmark::State& state) {
+  // Lane must fit all items of a producer as consumer drains afterwards
+  runMultipleProducers<FanInQueue<int, 16384>>(state);
+}
+
 BENCHMARK(BM_MultipleProducers)
     ->Args({1, 10000})
     ->Args({2, 10000})
@@ -66,4 +77,14 @@ BENCHMARK(BM_MultipleProducers)
     ->Args({64, 10000})
     ->ReportAggregatesOnly(true);
 
+BENCHMARK(BM_FanInMultipleProducers)
+    ->Args({1, 10000})
+    ->Args({2, 10000})
+    ->Args({4, 10000})
+    ->Args({8, 10000})
+    ->Args({16, 10000})
+    ->Args({32, 10000})
+    ->Args({64, 10000})
+    ->ReportAggregatesOnly(true);
+
 BENCHMARK_MAIN();
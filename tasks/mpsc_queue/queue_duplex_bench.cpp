@@ -0,0 +1,304 @@
+#include "fan_in_queue.hpp"
+#include "policy_queue.hpp"
+#include "queue.hpp"
+
+#include <benchmark/benchmark.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <latch>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace getrafty::concurrent;
+
+// Producers and consumer run concurrently, the way EventWatcher threads
+// post tasks while the loop thread drains them. Each item carries its
+// enqueue timestamp, the consumer records enqueue-to-dequeue latency.
+//
+// Arguments: number of producers, rate mode, pinning mode.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t kItemsPerProducer = 20000;
+constexpr auto kSteadyInterval     = std::chrono::microseconds(1);
+constexpr size_t kBurstSize        = 256;
+
+enum RateMode : int64_t {
+  // Back to back pushes
+  kSaturate = 0,
+  // One push every kSteadyInterval
+  kSteady = 1,
+  // kBurstSize pushes back to back, same average rate as kSteady
+  kBurst = 2,
+};
+
+enum PinMode : int64_t {
+  kNoPin = 0,
+  // Every thread on one core. Waits yield instead of spinning, so the
+  // thread that has work gets the core without waiting out a time slice.
+  kSameCore = 1,
+  // Producers away from consumer, on another socket if there is one
+  kCrossSocket = 2,
+};
+
+// Log-linear histogram: 16 linear sub-buckets per power of two, so any
+// recorded value is reported within ~6% of its true value.
+class LatencyHistogram {
+ public:
+  void record(uint64_t ns) { ++buckets_[indexOf(ns)]; }
+
+  void merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBuckets; ++i) {
+      buckets_[i] += other.buckets_[i];
+    }
+  }
+
+  [[nodiscard]] uint64_t percentile(double p) const {
+    uint64_t total = 0;
+    for (const auto count : buckets_) {
+      total += count;
+    }
+    const auto rank = static_cast<uint64_t>(p * static_cast<double>(total));
+    uint64_t seen   = 0;
+    for (size_t i = 0; i < kBuckets; ++i) {
+      seen += buckets_[i];
+      if (seen > rank) {
+        return valueOf(i);
+      }
+    }
+    return 0;
+  }
+
+ private:
+  static constexpr size_t kSubBits    = 4;
+  static constexpr size_t kSubBuckets = 1 << kSubBits;
+  static constexpr size_t kBuckets    = 64 * kSubBuckets;
+
+  static size_t indexOf(uint64_t value) {
+    if (value < kSubBuckets) {
+      return value;
+    }
+    const size_t shift = std::bit_width(value) - 1 - kSubBits;
+    return (shift + 1) * kSubBuckets + (value >> shift) - kSubBuckets;
+  }
+
+  // Lower bound of the bucket
+  static uint64_t valueOf(size_t index) {
+    if (index < kSubBuckets) {
+      return index;
+    }
+    const size_t shift = index / kSubBuckets - 1;
+    return (index % kSubBuckets + kSubBuckets) << shift;
+  }
+
+  std::array<uint64_t, kBuckets> buckets_{};
+};
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+void spinUntil(Clock::time_point deadline, bool yield) {
+  while (Clock::now() < deadline) {
+    if (yield) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+std::vector<int> allowedCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  sched_getaffinity(0, sizeof(set), &set);
+
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+int packageOf(int cpu) {
+  std::ifstream in("/sys/devices/system/cpu/cpu" + std::to_string(cpu) +
+                   "/topology/physical_package_id");
+  int package = 0;
+  in >> package;
+  return package;
+}
+
+bool pinTo(int cpu) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+struct Placement {
+  int consumer_cpu{-1};
+  // Round robin over these for producers, empty if unpinned
+  std::vector<int> producer_cpus;
+};
+
+// Fails if the mode needs more CPUs than the process may run on
+std::optional<Placement> placementFor(PinMode mode) {
+  if (mode == kNoPin) {
+    return Placement{};
+  }
+
+  const auto cpus = allowedCpus();
+  if (cpus.empty()) {
+    return std::nullopt;
+  }
+  const int consumer_cpu = cpus.front();
+  if (mode == kSameCore) {
+    return Placement{.consumer_cpu  = consumer_cpu,
+                     .producer_cpus = {consumer_cpu}};
+  }
+
+  std::vector<int> remote;
+  std::vector<int> local;
+  for (const auto cpu : cpus) {
+    if (cpu == consumer_cpu) {
+      continue;
+    }
+    if (packageOf(cpu) != packageOf(consumer_cpu)) {
+      remote.push_back(cpu);
+    } else {
+      local.push_back(cpu);
+    }
+  }
+  auto& producer_cpus = remote.empty() ? local : remote;
+  if (producer_cpus.empty()) {
+    return std::nullopt;
+  }
+  return Placement{.consumer_cpu  = consumer_cpu,
+                   .producer_cpus = std::move(producer_cpus)};
+}
+
+template <typename QueueT>
+void pushTo(QueueT& queue, int64_t value) {
+  if constexpr (requires { queue.push(value); }) {
+    queue.push(value);
+  } else {
+    while (!queue.tryPush(std::move(value))) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void produce(auto& queue, RateMode mode, bool yield) {
+  const auto start = Clock::now();
+  for (size_t i = 0; i < kItemsPerProducer; ++i) {
+    if (mode == kSteady) {
+      spinUntil(start + i * kSteadyInterval, yield);
+    } else if (mode == kBurst && i % kBurstSize == 0) {
+      spinUntil(start + i * kSteadyInterval, yield);
+    }
+    pushTo(queue, nowNs());
+  }
+}
+
+template <typename QueueT>
+void BM_Duplex(benchmark::State& state) {
+  const auto num_producers = static_cast<size_t>(state.range(0));
+  const auto rate_mode     = static_cast<RateMode>(state.range(1));
+  const auto pin_mode      = static_cast<PinMode>(state.range(2));
+  const auto total_items   = num_producers * kItemsPerProducer;
+  const bool yield         = pin_mode == kSameCore;
+
+  const auto placement = placementFor(pin_mode);
+  if (!placement) {
+    state.SkipWithError("Not enough CPUs for pinning mode");
+    return;
+  }
+
+  LatencyHistogram histogram;
+  QueueT queue;
+
+  for (auto _ : state) {
+    LatencyHistogram iteration;
+    std::latch start_latch(static_cast<ptrdiff_t>(num_producers + 1));
+
+    std::vector<std::thread> producers;
+    producers.reserve(num_producers);
+    for (size_t p = 0; p < num_producers; ++p) {
+      producers.emplace_back([&, p]() {
+        const auto& cpus = placement->producer_cpus;
+        if (!cpus.empty()) {
+          pinTo(cpus[p % cpus.size()]);
+        }
+        start_latch.arrive_and_wait();
+        produce(queue, rate_mode, yield);
+      });
+    }
+
+    std::thread consumer([&]() {
+      if (placement->consumer_cpu >= 0) {
+        pinTo(placement->consumer_cpu);
+      }
+      start_latch.arrive_and_wait();
+
+      size_t consumed = 0;
+      while (consumed < total_items) {
+        if (auto stamp = queue.tryTake()) {
+          iteration.record(static_cast<uint64_t>(nowNs() - *stamp));
+          ++consumed;
+        } else if (yield) {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    consumer.join();
+
+    histogram.merge(iteration);
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(total_items));
+  state.counters["p50_ns"]  = static_cast<double>(histogram.percentile(0.5));
+  state.counters["p99_ns"]  = static_cast<double>(histogram.percentile(0.99));
+  state.counters["p999_ns"] = static_cast<double>(histogram.percentile(0.999));
+}
+
+void duplexArgs(benchmark::internal::Benchmark* bench) {
+  bench->ArgNames({"producers", "rate", "pin"});
+  for (const int64_t producers : {1, 4, 16}) {
+    for (const int64_t rate : {kSaturate, kSteady, kBurst}) {
+      for (const int64_t pin : {kNoPin, kSameCore, kCrossSocket}) {
+        bench->Args({producers, rate, pin});
+      }
+    }
+  }
+  bench->UseRealTime()->Unit(benchmark::kMillisecond);
+}
+
+using BoundedMpsc = PolicyQueue<int64_t, QueuePolicy<4096>>;
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_Duplex, Queue<int64_t>)->Apply(duplexArgs);
+BENCHMARK_TEMPLATE(BM_Duplex, FanInQueue<int64_t>)->Apply(duplexArgs);
+BENCHMARK_TEMPLATE(BM_Duplex, PolicyQueue<int64_t>)->Apply(duplexArgs);
+BENCHMARK_TEMPLATE(BM_Duplex, BoundedMpsc)->Apply(duplexArgs);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+#include "epoch.hpp"
+#include "spsc_ring.hpp"
+
+// Non-blocking storage backends behind PolicyQueue. Every backend exposes
+//
+//   bool tryPush(T&& value);      // value is left untouched on failure
+//   std::optional<T> tryPop();
+//
+// and is only safe for the producer/consumer arity it is selected for.
+
+namespace getrafty::concurrent::detail {
+
+// Bounded ring with per-cell sequence numbers (D. Vyukov). Index updates
+// are CAS loops on the multi side and plain stores on the single side.
+template <typename T, size_t Capacity, bool MultiProducer, bool MultiConsumer,
+          bool Padded>
+class SequencedRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  SequencedRing() : cells_(std::make_unique<Cell[]>(Capacity)) {
+    for (size_t i = 0; i < Capacity; ++i) {
+      cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  // Non-copyable
+  SequencedRing(const SequencedRing&) = delete;
+
+  SequencedRing& operator=(const SequencedRing&) = delete;
+
+  // Non-movable
+  SequencedRing(SequencedRing&&) = delete;
+
+  ~SequencedRing() {
+    while (tryPop()) {
+    }
+  }
+
+  bool tryPush(T&& value) {
+    auto pos = tail_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+      cell           = &cells_[pos & kMask];
+      const auto seq = cell->seq_.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if constexpr (MultiProducer) {
+          if (tail_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            break;
+          }
+        } else {
+          tail_.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+
+    ::new (cell->storage_) T(std::move(value));
+    cell->seq_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> tryPop() {
+    auto pos = head_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+      cell           = &cells_[pos & kMask];
+      const auto seq = cell->seq_.load(std::memory_order_acquire);
+      const auto diff =
+          static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if constexpr (MultiConsumer) {
+          if (head_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            break;
+          }
+        } else {
+          head_.store(pos + 1, std::memory_order_relaxed);
+          break;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+
+    T* slot = cell->get();
+    std::optional<T> value{std::move(*slot)};
+    slot->~T();
+    cell->seq_.store(pos + Capacity, std::memory_order_release);
+    return value;
+  }
+
+ private:
+  static constexpr size_t kMask = Capacity - 1;
+
+  struct Cell {
+    std::atomic<size_t> seq_;
+    alignas(T) std::byte storage_[sizeof(T)];
+
+    T* get() { return std::launder(reinterpret_cast<T*>(storage_)); }
+  };
+
+  alignas(kIndexAlignment<Padded>) std::atomic<size_t> head_{0};
+  alignas(kIndexAlignment<Padded>) std::atomic<size_t> tail_{0};
+  alignas(kIndexAlignment<Padded>) std::unique_ptr<Cell[]> cells_;
+};
+
+// Unbounded single-producer/single-consumer linked queue. Consumer owns
+// every node behind the stub, so nodes can be freed without reclamation.
+template <typename T, bool Padded>
+class LinkedSpsc {
+ public:
+  LinkedSpsc() : head_(new Node()), tail_(head_) {}
+
+  // Non-copyable
+  LinkedSpsc(const LinkedSpsc&) = delete;
+
+  LinkedSpsc& operator=(const LinkedSpsc&) = delete;
+
+  // Non-movable
+  LinkedSpsc(LinkedSpsc&&) = delete;
+
+  ~LinkedSpsc() {
+    while (head_ != nullptr) {
+      delete std::exchange(head_, head_->next_.load(std::memory_order_relaxed));
+    }
+  }
+
+  bool tryPush(T&& value) {
+    auto* node = new Node();
+    node->value_.emplace(std::move(value));
+    tail_->next_.store(node, std::memory_order_release);
+    tail_ = node;
+    return true;
+  }
+
+  std::optional<T> tryPop() {
+    Node* next = head_->next_.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return std::nullopt;
+    }
+    // 'next' becomes the new stub
+    std::optional<T> value = std::move(next->value_);
+    next->value_.reset();
+    delete std::exchange(head_, next);
+    return value;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next_{nullptr};
+    std::optional<T> value_;
+  };
+
+  // Consumer side
+  alignas(kIndexAlignment<Padded>) Node* head_;
+  // Producer side
+  alignas(kIndexAlignment<Padded>) Node* tail_;
+};
+
+// Unbounded multi-producer/single-consumer linked queue (D. Vyukov).
+// Producers swing the tail with a single exchange. A producer preempted
+// between exchange and link makes the queue look empty until it resumes.
+template <typename T, bool Padded>
+class LinkedMpsc {
+ public:
+  LinkedMpsc() : head_(new Node()), tail_(head_) {}
+
+  // Non-copyable
+  LinkedMpsc(const LinkedMpsc&) = delete;
+
+  LinkedMpsc& operator=(const LinkedMpsc&) = delete;
+
+  // Non-movable
+  LinkedMpsc(LinkedMpsc&&) = delete;
+
+  ~LinkedMpsc() {
+    while (head_ != nullptr) {
+      delete std::exchange(head_, head_->next_.load(std::memory_order_relaxed));
+    }
+  }
+
+  bool tryPush(T&& value) {
+    auto* node = new Node();
+    node->value_.emplace(std::move(value));
+    Node* prev = tail_.exchange(node, std::memory_order_acq_rel);
+    prev->next_.store(node, std::memory_order_release);
+    return true;
+  }
+
+  std::optional<T> tryPop() {
+    Node* next = head_->next_.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      return std::nullopt;
+    }
+    std::optional<T> value = std::move(next->value_);
+    next->value_.reset();
+    delete std::exchange(head_, next);
+    return value;
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next_{nullptr};
+    std::optional<T> value_;
+  };
+
+  // Consumer side
+  alignas(kIndexAlignment<Padded>) Node* head_;
+  // Producer side
+  alignas(kIndexAlignment<Padded>) std::atomic<Node*> tail_;
+};
+
+// Unbounded multi-producer/multi-consumer linked queue (M. Michael and
+// M. Scott). Dequeued stubs may still be read by racing consumers and
+// producers, so they are retired to the epoch domain instead of deleted.
+template <typename T, bool Padded>
+class LinkedMpmc {
+ public:
+  LinkedMpmc() : head_(new Node()), tail_(head_.load()) {}
+
+  // Non-copyable
+  LinkedMpmc(const LinkedMpmc&) = delete;
+
+  LinkedMpmc& operator=(const LinkedMpmc&) = delete;
+
+  // Non-movable
+  LinkedMpmc(LinkedMpmc&&) = delete;
+
+  ~LinkedMpmc() {
+    Node* node = head_.load(std::memory_order_relaxed);
+    while (node != nullptr) {
+      delete std::exchange(node, node->next_.load(std::memory_order_relaxed));
+    }
+  }
+
+  bool tryPush(T&& value) {
+    auto* node = new Node();
+    node->value_.emplace(std::move(value));
+
+    auto guard = EpochDomain::global().pin();
+    while (true) {
+      Node* tail = tail_.load(std::memory_order_acquire);
+      Node* next = tail->next_.load(std::memory_order_acquire);
+      if (next != nullptr) {
+        // Help a lagging producer swing the tail
+        tail_.compare_exchange_weak(tail, next, std::memory_order_release,
+                                    std::memory_order_relaxed);
+        continue;
+      }
+      if (tail->next_.compare_exchange_weak(next, node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+        tail_.compare_exchange_strong(tail, node, std::memory_order_release,
+                                      std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  std::optional<T> tryPop() {
+    auto guard = EpochDomain::global().pin();
+    while (true) {
+      Node* head = head_.load(std::memory_order_acquire);
+      Node* next = head->next_.load(std::memory_order_acquire);
+      if (next == nullptr) {
+        return std::nullopt;
+      }
+      Node* tail = tail_.load(std::memory_order_acquire);
+      if (head == tail) {
+        // Never let head overtake tail, it would retire a node the tail
+        // still points to
+        tail_.compare_exchange_weak(tail, next, std::memory_order_release,
+                                    std::memory_order_relaxed);
+        continue;
+      }
+      // Release hands 'next' over to consumers that load it from 'head_'
+      if (head_.compare_exchange_weak(head, next, std::memory_order_acq_rel,
+                                      std::memory_order_relaxed)) {
+        // 'next' becomes the new stub, its value belongs to the winner
+        std::optional<T> value = std::move(next->value_);
+        next->value_.reset();
+        EpochDomain::global().retire(head);
+        return value;
+      }
+    }
+  }
+
+ private:
+  struct Node {
+    std::atomic<Node*> next_{nullptr};
+    std::optional<T> value_;
+  };
+
+  alignas(kIndexAlignment<Padded>) std::atomic<Node*> head_;
+  alignas(kIndexAlignment<Padded>) std::atomic<Node*> tail_;
+};
+
+}  // namespace getrafty::concurrent::detail
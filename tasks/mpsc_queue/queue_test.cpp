@@ -362,3 +362,92 @@ TEST(QueueTest, MultipleQueues) {
   EXPECT_FALSE(queue1.tryTake().has_value());
   EXPECT_FALSE(queue2.tryTake().has_value());
 }
+
+TEST(QueueTest, TakeReturnsAvailableItem) {
+  Queue<int> queue;
+
+  queue.push(42);
+
+  EXPECT_EQ(queue.take(), 42);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
+
+TEST(QueueTest, TakeBlocksUntilPush) {
+  Queue<int> queue;
+
+  std::atomic<bool> pushed{false};
+
+  std::thread producer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pushed.store(true, std::memory_order_release);
+    queue.push(7);
+  });
+
+  EXPECT_EQ(queue.take(), 7);
+  EXPECT_TRUE(pushed.load(std::memory_order_acquire));
+
+  producer.join();
+}
+
+TEST(QueueTest, TakeForTimesOut) {
+  Queue<int> queue;
+
+  const auto start  = std::chrono::steady_clock::now();
+  auto result       = queue.takeFor(std::chrono::milliseconds(50));
+  const auto waited = std::chrono::steady_clock::now() - start;
+
+  EXPECT_FALSE(result.has_value());
+  EXPECT_GE(waited, std::chrono::milliseconds(50));
+}
+
+TEST(QueueTest, TakeForReturnsPushedItem) {
+  Queue<int> queue;
+
+  std::thread producer([&]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.push(11);
+  });
+
+  auto result = queue.takeFor(std::chrono::seconds(5));
+
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(result.value(), 11);
+
+  producer.join();
+}
+
+TEST(QueueTest, BlockingConsumerStressTest) {
+  Queue<int> queue;
+
+  constexpr int kNumProducers     = 8;
+  constexpr int kItemsPerProducer = 10000;
+
+  std::vector<std::thread> producers;
+  producers.reserve(kNumProducers);
+
+  for (int p = 0; p < kNumProducers; ++p) {
+    producers.emplace_back([&queue]() {
+      for (int i = 0; i < kItemsPerProducer; ++i) {
+        queue.push(i);
+        if (i % 1000 == 0) {
+          // Let consumer drain and park
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+      }
+    });
+  }
+
+  int64_t consumed_sum = 0;
+  for (int i = 0; i < kNumProducers * kItemsPerProducer; ++i) {
+    consumed_sum += queue.take();
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  const int64_t expected_sum = static_cast<int64_t>(kNumProducers) *
+                               kItemsPerProducer * (kItemsPerProducer - 1) / 2;
+  EXPECT_EQ(consumed_sum, expected_sum);
+  EXPECT_FALSE(queue.tryTake().has_value());
+}
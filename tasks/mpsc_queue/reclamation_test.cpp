@@ -0,0 +1,244 @@
+#include "epoch.hpp"
+#include "hazard_pointers.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <latch>
+#include <thread>
+#include <vector>
+
+using namespace getrafty::concurrent;
+
+namespace {
+
+struct Tracked {
+  explicit Tracked(std::atomic<int>& reclaimed, int value = 0)
+      : reclaimed(reclaimed), value(value) {}
+
+  ~Tracked() { reclaimed.fetch_add(1, std::memory_order_relaxed); }
+
+  std::atomic<int>& reclaimed;
+  int value;
+};
+
+// Readers repeatedly dereference 'shared' while the writer keeps replacing
+// and retiring it. Values are checked to catch reads of reclaimed nodes.
+template <typename Reader, typename Retire>
+void swapUnderReaders(std::atomic<Tracked*>& shared,
+                      std::atomic<int>& reclaimed, Reader reader,
+                      Retire retire) {
+  constexpr int kReaders = 4;
+  constexpr int kSwaps   = 20000;
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int r = 0; r < kReaders; ++r) {
+    readers.emplace_back([&]() {
+      while (!done.load(std::memory_order_acquire)) {
+        reader();
+      }
+    });
+  }
+
+  for (int i = 0; i < kSwaps; ++i) {
+    auto* node = new Tracked(reclaimed, 42);
+    retire(shared.exchange(node, std::memory_order_acq_rel));
+    if (i % 64 == 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  done.store(true, std::memory_order_release);
+  for (auto& reader_thread : readers) {
+    reader_thread.join();
+  }
+}
+
+}  // namespace
+
+TEST(EpochDomainTest, ReclaimsAfterEpochsPass) {
+  std::atomic<int> reclaimed{0};
+  EpochDomain domain;
+
+  domain.retire(new Tracked(reclaimed));
+
+  for (int i = 0; i < 3; ++i) {
+    domain.collect();
+  }
+  EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(EpochDomainTest, PinnedThreadHoldsBackReclamation) {
+  std::atomic<int> reclaimed{0};
+  EpochDomain domain;
+
+  std::latch pinned(1);
+  std::latch unpin(1);
+  std::thread reader([&]() {
+    auto guard = domain.pin();
+    pinned.count_down();
+    unpin.wait();
+  });
+  pinned.wait();
+
+  domain.retire(new Tracked(reclaimed));
+  for (int i = 0; i < 10; ++i) {
+    domain.collect();
+  }
+  EXPECT_EQ(reclaimed.load(), 0);
+
+  unpin.count_down();
+  reader.join();
+
+  for (int i = 0; i < 3; ++i) {
+    domain.collect();
+  }
+  EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(EpochDomainTest, NestedPins) {
+  EpochDomain domain;
+
+  auto outer = domain.pin();
+  {
+    auto inner = domain.pin();
+  }
+  const auto epoch = domain.epoch();
+  domain.collect();
+  domain.collect();
+  // Still pinned by 'outer' at the initial epoch
+  EXPECT_LE(domain.epoch(), epoch + 1);
+}
+
+TEST(EpochDomainTest, RetireBatchesReclaimWithoutCollect) {
+  std::atomic<int> reclaimed{0};
+  EpochDomain domain;
+
+  constexpr int kRetired = 10 * EpochDomain::kRetireBatch;
+  for (int i = 0; i < kRetired; ++i) {
+    domain.retire(new Tracked(reclaimed));
+  }
+
+  EXPECT_GT(reclaimed.load(), 0);
+  EXPECT_LT(reclaimed.load(), kRetired);
+}
+
+TEST(EpochDomainTest, DestructorReclaimsEverything) {
+  std::atomic<int> reclaimed{0};
+  {
+    EpochDomain domain;
+    std::thread([&]() { domain.retire(new Tracked(reclaimed)); }).join();
+    domain.retire(new Tracked(reclaimed));
+  }
+  EXPECT_EQ(reclaimed.load(), 2);
+}
+
+TEST(EpochDomainTest, ConcurrentReadersNeverSeeReclaimedNodes) {
+  std::atomic<int> reclaimed{0};
+  {
+    EpochDomain domain;
+    std::atomic<Tracked*> shared{new Tracked(reclaimed, 42)};
+
+    swapUnderReaders(
+        shared, reclaimed,
+        [&]() {
+          auto guard = domain.pin();
+          Tracked* node = shared.load(std::memory_order_acquire);
+          ASSERT_EQ(node->value, 42);
+        },
+        [&](Tracked* node) { domain.retire(node); });
+
+    delete shared.load();
+  }
+  EXPECT_EQ(reclaimed.load(), 20001);
+}
+
+TEST(HazardDomainTest, ReclaimsUnprotected) {
+  std::atomic<int> reclaimed{0};
+  HazardDomain domain;
+
+  domain.retire(new Tracked(reclaimed));
+  domain.collect();
+
+  EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(HazardDomainTest, ProtectedNodeSurvivesCollect) {
+  std::atomic<int> reclaimed{0};
+  HazardDomain domain;
+  std::atomic<Tracked*> shared{new Tracked(reclaimed, 7)};
+
+  std::latch protected_latch(1);
+  std::latch release(1);
+  std::thread reader([&]() {
+    auto hazard = domain.makeHazardPointer();
+    Tracked* node = hazard.protect(shared);
+    protected_latch.count_down();
+    release.wait();
+    EXPECT_EQ(node->value, 7);
+  });
+  protected_latch.wait();
+
+  domain.retire(shared.exchange(nullptr));
+  domain.collect();
+  EXPECT_EQ(reclaimed.load(), 0);
+
+  release.count_down();
+  reader.join();
+
+  domain.collect();
+  EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(HazardDomainTest, OutOfSlotsThrows) {
+  HazardDomain domain;
+
+  std::vector<HazardDomain::HazardPointer> hazards;
+  for (size_t i = 0; i < HazardDomain::kSlotsPerThread; ++i) {
+    hazards.push_back(domain.makeHazardPointer());
+  }
+  EXPECT_THROW(
+      { [[maybe_unused]] auto extra = domain.makeHazardPointer(); },
+      std::length_error);
+
+  // Slot is returned when the hazard pointer is destroyed
+  hazards.pop_back();
+  EXPECT_NO_THROW(
+      { [[maybe_unused]] auto extra = domain.makeHazardPointer(); });
+}
+
+TEST(HazardDomainTest, DestructorReclaimsEverything) {
+  std::atomic<int> reclaimed{0};
+  {
+    HazardDomain domain;
+    std::atomic<Tracked*> shared{new Tracked(reclaimed)};
+    auto hazard = domain.makeHazardPointer();
+    hazard.protect(shared);
+    domain.retire(shared.load());
+    domain.collect();
+    EXPECT_EQ(reclaimed.load(), 0);
+    hazard.reset();
+  }
+  EXPECT_EQ(reclaimed.load(), 1);
+}
+
+TEST(HazardDomainTest, ConcurrentReadersNeverSeeReclaimedNodes) {
+  std::atomic<int> reclaimed{0};
+  {
+    HazardDomain domain;
+    std::atomic<Tracked*> shared{new Tracked(reclaimed, 42)};
+
+    swapUnderReaders(
+        shared, reclaimed,
+        [&]() {
+          auto hazard   = domain.makeHazardPointer();
+          Tracked* node = hazard.protect(shared);
+          ASSERT_EQ(node->value, 42);
+        },
+        [&](Tracked* node) { domain.retire(node); });
+
+    delete shared.load();
+  }
+  EXPECT_EQ(reclaimed.load(), 20001);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace getrafty::concurrent {
+
+inline constexpr size_t kCacheLineSize = 64;
+
+// Alignment of indices shared between threads: either own cache line each
+// or packed together
+template <bool Padded>
+inline constexpr size_t kIndexAlignment =
+    Padded ? kCacheLineSize : alignof(std::atomic<size_t>);
+
+// Bounded wait-free single-producer/single-consumer ring.
+//
+// Head and tail live on separate cache lines (unless Padded is off) and each
+// side keeps a cached copy of the opposite index, so in steady state producer
+// and consumer only touch shared memory when the cached view says the ring is
+// full/empty.
+template <typename T, size_t Capacity, bool Padded = true>
+class SpscRing {
+  static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+ public:
+  SpscRing() : slots_(std::make_unique<Slot[]>(Capacity)) {}
+
+  // Non-copyable
+  SpscRing(const SpscRing&) = delete;
+
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  // Non-movable
+  SpscRing(SpscRing&&) = delete;
+
+  ~SpscRing() {
+    while (tryPop()) {
+    }
+  }
+
+  // Producer only. Value is left untouched if ring is full.
+  bool tryPush(T&& value) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ == Capacity) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ == Capacity) {
+        return false;
+      }
+    }
+
+    ::new (slots_[tail & kMask].storage_) T(std::move(value));
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer only
+  std::optional<T> tryPop() {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) {
+        return std::nullopt;
+      }
+    }
+
+    T* slot = slots_[head & kMask].get();
+    std::optional<T> value{std::move(*slot)};
+    slot->~T();
+    head_.store(head + 1, std::memory_order_release);
+    return value;
+  }
+
+  // Consumer only
+  [[nodiscard]] bool empty() const {
+    return head_.load(std::memory_order_relaxed) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  static constexpr size_t capacity() { return Capacity; }
+
+ private:
+  static constexpr size_t kMask = Capacity - 1;
+
+  struct Slot {
+    alignas(T) std::byte storage_[sizeof(T)];
+
+    T* get() { return std::launder(reinterpret_cast<T*>(storage_)); }
+  };
+
+  // Consumer side
+  alignas(kIndexAlignment<Padded>) std::atomic<size_t> head_{0};
+  size_t tail_cache_{0};
+
+  // Producer side
+  alignas(kIndexAlignment<Padded>) std::atomic<size_t> tail_{0};
+  size_t head_cache_{0};
+
+  alignas(kIndexAlignment<Padded>) std::unique_ptr<Slot[]> slots_;
+};
+
+}  // namespace getrafty::concurrent
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace getrafty::concurrent::detail {
+
+inline uint64_t nextRegistryId() {
+  static std::atomic<uint64_t> next_id{1};
+  return next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+// Object unlinked from a shared structure and awaiting reclamation
+struct Retired {
+  void* ptr;
+  void (*deleter)(void*);
+
+  void reclaim() const { deleter(ptr); }
+};
+
+template <typename T>
+void deleteAs(void* ptr) {
+  delete static_cast<T*>(ptr);
+}
+
+// Lock-free list of per-thread records. Records are never unlinked while
+// the registry is alive, a record released by an exited thread is handed
+// over to the next registering one together with whatever it still holds.
+//
+// Record must provide 'std::atomic<bool> in_use_' and 'Record* next_'.
+template <typename Record>
+class ThreadRegistry {
+ public:
+  ThreadRegistry() = default;
+
+  // Non-copyable
+  ThreadRegistry(const ThreadRegistry&) = delete;
+
+  ThreadRegistry& operator=(const ThreadRegistry&) = delete;
+
+  // Non-movable
+  ThreadRegistry(ThreadRegistry&&) = delete;
+
+  ~ThreadRegistry() {
+    Record* record = head_.load(std::memory_order_acquire);
+    while (record != nullptr) {
+      delete std::exchange(record, record->next_);
+    }
+  }
+
+  Record* acquire() {
+    for (Record* record = head_.load(std::memory_order_acquire);
+         record != nullptr; record = record->next_) {
+      if (record->in_use_.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      bool expected = false;
+      if (record->in_use_.compare_exchange_strong(expected, true,
+                                                  std::memory_order_acquire)) {
+        return record;
+      }
+    }
+
+    auto* record = new Record();
+    record->in_use_.store(true, std::memory_order_relaxed);
+    record->next_ = head_.load(std::memory_order_relaxed);
+    while (!head_.compare_exchange_weak(record->next_, record,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed)) {
+    }
+    size_.fetch_add(1, std::memory_order_relaxed);
+    return record;
+  }
+
+  void release(Record* record) {
+    // Publishes record contents to the next owner
+    record->in_use_.store(false, std::memory_order_release);
+  }
+
+  // Visits every record ever registered, including released ones
+  template <typename F>
+  void forEach(F&& f) {
+    for (Record* record = head_.load(std::memory_order_acquire);
+         record != nullptr; record = record->next_) {
+      f(*record);
+    }
+  }
+
+  [[nodiscard]] size_t size() const {
+    return size_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  std::atomic<Record*> head_{nullptr};
+  std::atomic<size_t> size_{0};
+};
+
+// Record of the calling thread in 'registry', registered on first use and
+// released when the thread exits. Registry is shared so that a thread
+// outliving the owning domain can still release its record.
+template <typename Record>
+Record& localRecord(uint64_t registry_id,
+                    const std::shared_ptr<ThreadRegistry<Record>>& registry) {
+  struct Local {
+    uint64_t registry_id;
+    std::shared_ptr<ThreadRegistry<Record>> registry;
+    Record* record;
+  };
+
+  struct Locals {
+    std::vector<Local> entries;
+
+    ~Locals() {
+      for (const auto& local : entries) {
+        local.registry->release(local.record);
+      }
+    }
+  };
+
+  // Keyed by id rather than address so a registry allocated at the address
+  // of a destroyed one never picks up its dangling records
+  thread_local Locals locals;
+  for (const auto& local : locals.entries) {
+    if (local.registry_id == registry_id) {
+      return *local.record;
+    }
+  }
+
+  // Slow path: drop records of destroyed registries and register a new one
+  std::erase_if(locals.entries, [](const Local& local) {
+    return local.registry.use_count() == 1;
+  });
+  Record* record = registry->acquire();
+  locals.entries.push_back(
+      {.registry_id = registry_id, .registry = registry, .record = record});
+  return *record;
+}
+
+}  // namespace getrafty::concurrent::detail
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace getrafty::io {
+
+namespace detail {
+
+// Watch callbacks of one loop, indexed by fd.
+//
+// A slot holds both directions of one fd and is allocated in fixed chunks
+// that never move. Callbacks live in a pool with stable addresses and are
+// recycled, so the table does not allocate in steady state; what the
+// callback itself holds is up to the caller. A callback may unwatch or
+// replace itself while it runs: removed callbacks are parked and only
+// destroyed once dispatch is over.
+//
+// Each fd carries a generation that is bumped whenever the fd is
+// registered anew. It travels with the fd in epoll_event.data, so events
+// of a registration that is gone can be told apart from events of a new
+// one on the same fd number.
+template <typename Callback, typename Flag>
+class CallbackTable {
+ public:
+  static constexpr size_t kChunkSize = 256;
+
+  struct Slot {
+    // By direction, null if not watched
+    std::array<Callback*, 2> callbacks{};
+    std::array<Flag, 2> modifiers{};
+    // Bit per direction
+    uint8_t watched{0};
+    // Bit per direction reported by a one-shot registration since watched
+    uint8_t fired{0};
+    uint32_t generation{0};
+    // Interest last handed to the kernel, 0 if fd is not registered
+    uint32_t registered{0};
+    // Queued in the owner's change list
+    bool pending{false};
+    // Apply even if interest is unchanged, to re-evaluate readiness
+    bool rearm{false};
+  };
+
+  // Result of find, usable like an unordered_map iterator: 'first' is the
+  // key, 'second' points at the callback, or is null for end(). The pointer
+  // stays valid until releaseParked, even if the direction is unwatched.
+  struct Ref {
+    std::pair<int, Flag> first;
+    Callback* second;
+
+    const Ref* operator->() const { return this; }
+
+    const Ref& operator*() const { return *this; }
+
+    bool operator==(const Ref& that) const { return second == that.second; }
+  };
+
+  [[nodiscard]] Ref find(const std::pair<int, Flag>& key) {
+    auto* slot = slotOf(key.first);
+    if (slot == nullptr || (slot->watched & bitOf(key.second)) == 0) {
+      return end();
+    }
+    return {key, slot->callbacks[key.second]};
+  }
+
+  [[nodiscard]] Ref end() const { return {{-1, Flag{}}, nullptr}; }
+
+  [[nodiscard]] bool contains(const std::pair<int, Flag>& key) const {
+    const auto* slot = slotOf(key.first);
+    return slot != nullptr && (slot->watched & bitOf(key.second)) != 0;
+  }
+
+  // Null if fd was never watched
+  [[nodiscard]] Slot* slotOf(const int fd) const {
+    const auto chunk = static_cast<size_t>(fd) / kChunkSize;
+    if (fd < 0 || chunk >= chunks_.size() || !chunks_[chunk]) {
+      return nullptr;
+    }
+    return &(*chunks_[chunk])[static_cast<size_t>(fd) % kChunkSize];
+  }
+
+  Slot& ensure(const int fd) {
+    const auto chunk = static_cast<size_t>(fd) / kChunkSize;
+    if (chunk >= chunks_.size()) {
+      chunks_.resize(chunk + 1);
+    }
+    if (!chunks_[chunk]) {
+      chunks_[chunk] = std::make_unique<Chunk>();
+    }
+    return (*chunks_[chunk])[static_cast<size_t>(fd) % kChunkSize];
+  }
+
+  // Returns true if the direction was not watched before
+  bool assign(const int fd, const Flag direction, const Flag modifiers,
+              Callback callback) {
+    auto& slot = ensure(fd);
+    if (slot.watched == 0) {
+      ++slot.generation;
+    }
+    const bool inserted = (slot.watched & bitOf(direction)) == 0;
+    if (!inserted) {
+      parked_.push_back(slot.callbacks[direction]);
+    }
+    slot.callbacks[direction] = acquire(std::move(callback));
+    slot.modifiers[direction] = modifiers;
+    slot.watched |= bitOf(direction);
+    slot.fired &= ~bitOf(direction);
+    return inserted;
+  }
+
+  // Returns false if the direction was not watched
+  bool erase(const int fd, const Flag direction) {
+    auto* slot = slotOf(fd);
+    if (slot == nullptr || (slot->watched & bitOf(direction)) == 0) {
+      return false;
+    }
+    parked_.push_back(std::exchange(slot->callbacks[direction], nullptr));
+    slot->modifiers[direction] = Flag{};
+    slot->watched &= ~bitOf(direction);
+    slot->fired &= ~bitOf(direction);
+    return true;
+  }
+
+  // Calls fn(fd, slot) for every fd with at least one direction watched
+  template <typename Fn>
+  void forEach(Fn&& fn) {
+    for (size_t chunk = 0; chunk < chunks_.size(); ++chunk) {
+      if (!chunks_[chunk]) {
+        continue;
+      }
+      for (size_t i = 0; i < kChunkSize; ++i) {
+        auto& slot = (*chunks_[chunk])[i];
+        if (slot.watched != 0) {
+          fn(static_cast<int>(chunk * kChunkSize + i), slot);
+        }
+      }
+    }
+  }
+
+  // Destroys callbacks removed so far, none of them may be running
+  void releaseParked() {
+    for (auto* callback : parked_) {
+      *callback = nullptr;
+      free_.push_back(callback);
+    }
+    parked_.clear();
+  }
+
+  // epoll_event.data layout: fd in the low half, read back as data.fd
+  static uint64_t pack(const int fd, const uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) |
+           static_cast<uint32_t>(fd);
+  }
+
+  static uint32_t generationOf(const epoll_data_t data) {
+    return static_cast<uint32_t>(data.u64 >> 32);
+  }
+
+  static uint8_t bitOf(const Flag direction) {
+    return static_cast<uint8_t>(1u << direction);
+  }
+
+ private:
+  using Chunk = std::array<Slot, kChunkSize>;
+
+  Callback* acquire(Callback&& callback) {
+    Callback* slot = nullptr;
+    if (free_.empty()) {
+      slot = &pool_.emplace_back();
+    } else {
+      slot = free_.back();
+      free_.pop_back();
+    }
+    *slot = std::move(callback);
+    return slot;
+  }
+
+  std::vector<std::unique_ptr<Chunk>> chunks_;
+  // Deque keeps addresses stable as it grows
+  std::deque<Callback> pool_;
+  std::vector<Callback*> free_;
+  std::vector<Callback*> parked_;
+};
+
+}  // namespace detail
+}  // namespace getrafty::io
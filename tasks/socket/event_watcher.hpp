@@ -1,17 +1,23 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <thread>
-#include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include <sys/epoll.h>
 
 #include <bits/queue.hpp>
-#include "hash.hpp"
+#include "callback_table.hpp"
+#include "loop_monitor.hpp"
+#include "timer_queue.hpp"
 
 namespace getrafty::io {
 
@@ -20,15 +26,49 @@ using WatchCallbackPtr = std::shared_ptr<WatchCallback>;
 
 using EpollWaitFunc = std::move_only_function<int(int, epoll_event*, int, int)>;
 
+using HookId = uint64_t;
+
+constexpr HookId kInvalidHook = 0;
+
 enum WatchFlag : uint8_t {
   RDONLY = 0x00,
   WRONLY = 0x01,
+
+  // Modifiers, or-ed with a direction
+
+  // Edge-triggered: callback fires when fd becomes ready, so it has to
+  // drain until EAGAIN
+  EDGE = 0x02,
+  // Callback fires once, watching the same fd and direction again re-arms.
+  // epoll arms an fd as a whole, so on the epoll loop both watched
+  // directions have to agree on it; a watch that does not is rejected with
+  // an error.
+  ONESHOT = 0x04,
+  // Dispatch order among fds ready in the same iteration: high before
+  // unmarked before low. An fd watched both ways takes the higher class.
+  HIGH_PRIORITY = 0x08,
+  LOW_PRIORITY  = 0x10,
 };
 
+constexpr WatchFlag operator|(const WatchFlag lhs, const WatchFlag rhs) {
+  return static_cast<WatchFlag>(static_cast<uint8_t>(lhs) |
+                                static_cast<uint8_t>(rhs));
+}
+
+constexpr WatchFlag directionOf(const WatchFlag flag) {
+  return static_cast<WatchFlag>(flag & WRONLY);
+}
+
+constexpr WatchFlag modifiersOf(const WatchFlag flag) {
+  return static_cast<WatchFlag>(flag & ~WRONLY);
+}
+
 namespace detail {
-struct Pipe {
-  Pipe();
-  ~Pipe();
+// Wakeup doorbell. Both ends refer to the same non-blocking eventfd, so the
+// loop can keep treating it as a pipe.
+struct EventFd {
+  EventFd();
+  ~EventFd();
   int read_end_;
   int write_end_;
 };
@@ -36,6 +76,9 @@ struct Pipe {
 
 class EventWatcher {
  public:
+  // Tasks run per loop iteration unless configured otherwise
+  static constexpr size_t kDefaultTaskBudget = 256;
+
   explicit EventWatcher(EpollWaitFunc epoll_impl = ::epoll_wait);
   virtual ~EventWatcher();
 
@@ -49,23 +92,212 @@ class EventWatcher {
   virtual void unwatchAll();
   virtual void runInEventWatcherLoop(WatchCallback task);
 
+  // Runs 'task' right away when called on the loop thread, saving the
+  // queue hop and wakeup; posts it otherwise
+  void dispatch(WatchCallback task);
+
+  [[nodiscard]] bool isInLoopThread() const { return current_ == this; }
+
+  // Timers fire on the loop thread, may be scheduled from any thread
+  TimerId runAfter(std::chrono::steady_clock::duration delay,
+                   WatchCallback callback);
+  TimerId runEvery(std::chrono::steady_clock::duration period,
+                   WatchCallback callback);
+  // Timer that is already due when cancel reaches the loop still fires
+  void cancel(TimerId id);
+
+  // Loop latency metrics, readable from any thread
+  [[nodiscard]] LoopStats stats() const { return monitor_.stats(); }
+
+  // Off by default. Reports iterations running longer than 'threshold'
+  // along with the stack of the loop thread, logs them if no handler given.
+  // Needs a loop thread, logs an error otherwise.
+  void startWatchdog(std::chrono::steady_clock::duration threshold,
+                     StallHandler handler = {});
+  void stopWatchdog();
+
+  // Off by default. Before blocking, the loop spins on the ready list and
+  // the task queue for up to 'budget', trading a core for wakeup latency.
+  // Spins that find nothing halve the next one, spins that find work grow
+  // it back. Zero turns spinning off. Epoll loop only, logs an error on
+  // other backends.
+  void setBusyPoll(std::chrono::steady_clock::duration budget);
+
+  // Caps on tasks run and ready events taken per loop iteration, so a flood
+  // of either cannot starve the other; leftovers carry over to the next
+  // iteration. Zero 'max_events' leaves the event cap to the loop.
+  // 'max_low_priority' caps LOW_PRIORITY events dispatched per iteration,
+  // the rest are held back for the next one; zero means no cap. Every loop
+  // with a thread of its own caps tasks; the event caps are epoll loop only
+  // and log an error on other backends.
+  void setIterationBudget(size_t max_tasks, int max_events = 0,
+                          int max_low_priority = 0);
+
+  // Hook runs on the loop thread once per iteration, after ready callbacks
+  // and tasks, right before the loop waits again. Meant for flushing what
+  // the iteration batched up. Run by every loop with a thread of its own.
+  HookId onBeforeWait(WatchCallback hook);
+  // Hook may remove itself
+  void removeBeforeWait(HookId id);
+
+ protected:
+  struct NoLoop {};
+
+  // For backends that run their own loop: no epoll instance, no thread
+  explicit EventWatcher(NoLoop);
+
+  // Backends fire expired timers and bound their wait by the next deadline
+  TimerQueue& timerQueue() { return timers_; }
+
+  // Clock timer deadlines are computed from, backends may keep their own
+  [[nodiscard]] virtual TimerQueue::Clock::time_point clockNow() const {
+    return TimerQueue::Clock::now();
+  }
+
+  // Called by the loop thread before it runs anything
+  void bindLoopThread() { current_ = this; }
+
+  // Loop machinery shared with backends that run a loop thread of their
+  // own. Such a backend starts its loop with startLoopThread and has to call
+  // stopLoopThread from its destructor, before its own state goes away.
+  void startLoopThread(WatchCallback loop);
+  void stopLoopThread();
+  [[nodiscard]] bool running() const {
+    return running_.load(std::memory_order_acquire);
+  }
+
+  // Queues 'task' for runPendingTasks and wakes the loop
+  void post(WatchCallback task);
+  // Non-blocking eventfd wakeup() rings, readable until drained
+  [[nodiscard]] int wakeupFd() const { return wakeup_pipe_.read_end_; }
+  void drainWakeup();
+
+  // Loop thread only, the pieces of one iteration
+  void runPendingTasks();
+  // Task budget ran out, the rest must run without waiting for I/O
+  [[nodiscard]] bool taskBacklog() const { return task_backlog_; }
+  void runTimerOps();
+  void runBeforeWaitHooks();
+  // Tells producers to ring the doorbell from now on. False if the loop
+  // must not block after all: a task was posted meanwhile or the loop is
+  // stopping. Blocking ends with awake().
+  bool prepareToSleep();
+  void awake();
+  // Metrics: wait begins, wait ends, a callback ran for 'elapsed'
+  void beforeWait(LoopMonitor::Clock::time_point now);
+  void beginIteration(LoopMonitor::Clock::time_point now);
+  void recordCallback(LoopMonitor::Clock::duration elapsed);
+
  private:
   using W = std::pair<int, WatchFlag>;
 
+  // Bits of wakeup_state_
+  static constexpr uint32_t kSleeping = 0x1;
+  static constexpr uint32_t kNotified = 0x2;
+
+  // Watcher whose loop runs on the calling thread
+  static thread_local const EventWatcher* current_;
+
   int epoll_fd_;
-  detail::Pipe wakeup_pipe_;
+  detail::EventFd wakeup_pipe_;
+  // Producers ring the doorbell only if loop sleeps and nobody rang it yet
+  std::atomic<uint32_t> wakeup_state_{0};
+  // When the first task since the last drain was posted, 0 if none
+  std::atomic<LoopMonitor::Clock::rep> posted_at_{0};
+
+  // Pool entry of callbacks_, times the callback for the monitor in place
+  // rather than through a second wrapper
+  struct TimedCallback {
+    WatchCallback callback;
+    LoopMonitor* monitor{nullptr};
 
-  std::unordered_map<W, WatchCallbackPtr, bits::Hash<W>> callbacks_;
+    void operator()();
+
+    TimedCallback& operator=(std::nullptr_t) {
+      callback = nullptr;
+      return *this;
+    }
+  };
+
+  using Callbacks = detail::CallbackTable<TimedCallback, WatchFlag>;
+
+  // Loop thread only. callbacks_.find({fd, direction}) stands in for the
+  // map lookup: compare with callbacks_.end(), 'second' points at the
+  // callback. Generations are checked before events reach the loop.
+  Callbacks callbacks_;
+  // Batch returned by the last pollEvents, being dispatched
+  epoll_event* polled_{nullptr};
+  int polled_count_{0};
+  // Fds whose interest changed since the last wait, applied all at once
+  std::vector<int> changes_;
 
   std::atomic<bool> running_{false};
   bits::MPSCQueue<WatchCallback> task_queue_;
 
+  // Loop thread only
+  TimerQueue timers_;
+  std::atomic<TimerId> next_timer_id_{kInvalidTimer + 1};
+  // Adds and cancels posted from other threads, in order
+  bits::MPSCQueue<WatchCallback> timer_ops_;
+
+  LoopMonitor monitor_;
+
+  std::atomic<std::chrono::steady_clock::rep> busy_poll_budget_{0};
+  // Loop thread only, current spin adapted to load
+  std::chrono::steady_clock::duration spin_budget_{};
+
+  std::atomic<size_t> task_budget_{kDefaultTaskBudget};
+  std::atomic<int> event_budget_{0};
+  std::atomic<int> low_priority_budget_{0};
+  // Loop thread only
+  size_t tasks_run_{0};
+  bool task_backlog_{false};
+  // Ready events held back by priority, dispatched in the next batch
+  std::vector<epoll_event> deferred_;
+  // Batch being reordered by priority
+  std::vector<epoll_event> ordered_;
+
+  struct Hook {
+    HookId id;
+    WatchCallback callback;
+  };
+
+  // Loop thread only. Deque keeps a running hook in place when another one
+  // is added.
+  std::deque<Hook> hooks_;
+  bool running_hooks_{false};
+  std::atomic<HookId> next_hook_id_{kInvalidHook + 1};
+
+  // User supplied epoll_wait, called by pollEvents
+  EpollWaitFunc epoll_wait_;
+  // What the loop calls to wait for events, bound to pollEvents
   EpollWaitFunc epoll_impl_;
   std::unique_ptr<std::thread> loop_thread_;
 
   void waitLoop();
-  void wakeup() const;
+  int pollEvents(int epoll_fd, epoll_event* events, int max_events,
+                 int timeout_ms);
+  void wakeup();
   void onWakeup(int fd);
+  std::optional<int> busyPoll(int epoll_fd, epoll_event* events,
+                              int max_events, int wait_ms);
+  int eventBudget(int max_events) const;
+  int remember(epoll_event* events, int num_events, int max_events);
+  int prioritize(epoll_event* events, int num_events, int max_events);
+  // Drops stale events and strips generations, returns events kept
+  int unpack(epoll_event* events, int num_events) const;
+  void rearmOneShot(const epoll_event* events, int num_events);
+  int priorityOf(const epoll_event& event) const;
+  uint32_t epollEventsFor(int fd) const;
+  // Loop thread part of watch
+  void assignWatch(int fd, WatchFlag flag, WatchCallback callback);
+  void markChanged(int fd, bool rearm);
+  void applyChanges();
+  void dropPolledEvents(int fd, uint32_t generation);
+  void postTimerOp(WatchCallback op);
+  TimerId addTimer(std::chrono::steady_clock::duration delay,
+                   std::chrono::steady_clock::duration period,
+                   WatchCallback callback);
   void invokeCallback(int fd, WatchFlag flag);
 };
 
@@ -0,0 +1,322 @@
+#include <benchmark/benchmark.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bits/algo.hpp>
+#include <bits/ttl/ttl.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <latch>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "event_watcher.hpp"
+#include "uring_event_watcher.hpp"
+
+using namespace getrafty::io;
+
+namespace {
+
+// Closes the fds it owns, so benchmarks bail out cleanly
+class Fds {
+ public:
+  Fds() = default;
+  ~Fds() {
+    for (const int fd : fds_) {
+      ::close(fd);
+    }
+  }
+
+  // Non-copyable
+  Fds(const Fds&) = delete;
+
+  Fds& operator=(const Fds&) = delete;
+
+  // Non-movable
+  Fds(Fds&&) = delete;
+
+  Fds& operator=(Fds&&) = delete;
+
+  // Read and write end, or {-1, -1}
+  std::pair<int, int> pipe() {
+    int ends[2];
+    if (::pipe2(ends, O_NONBLOCK | O_CLOEXEC) != 0) {
+      return {-1, -1};
+    }
+    fds_.push_back(ends[0]);
+    fds_.push_back(ends[1]);
+    return {ends[0], ends[1]};
+  }
+
+  int dup(const int fd) {
+    const int copy = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy >= 0) {
+      fds_.push_back(copy);
+    }
+    return copy;
+  }
+
+ private:
+  std::vector<int> fds_;
+};
+
+// Registrations cost an fd each, raise the soft limit as far as allowed
+bool reserveFds(const size_t count) {
+  rlimit limit{};
+  if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+    return false;
+  }
+  if (limit.rlim_cur >= count) {
+    return true;
+  }
+  if (limit.rlim_max < count) {
+    return false;
+  }
+  limit.rlim_cur = count;
+  return ::setrlimit(RLIMIT_NOFILE, &limit) == 0;
+}
+
+void runOnLoop(EventWatcher& watcher, WatchCallback task) {
+  std::latch done(1);
+  watcher.runInEventWatcherLoop([&, task = std::move(task)]() mutable {
+    task();
+    done.count_down();
+  });
+  done.wait();
+}
+
+void unwatchAllRead(EventWatcher& watcher, const std::vector<int>& fds) {
+  runOnLoop(watcher, [&]() {
+    for (const int fd : fds) {
+      watcher.unwatch(fd, RDONLY);
+    }
+  });
+}
+
+}  // namespace
+
+// Round trip of one task posted from another thread: queue, doorbell,
+// loop wakeup and back
+template <typename Watcher>
+static void BM_PostLatency(benchmark::State& state) {
+  Watcher watcher;
+  std::vector<double> samples;
+  samples.reserve(state.max_iterations);
+
+  for (auto _ : state) {
+    std::atomic<bool> ran{false};
+    const auto start = std::chrono::steady_clock::now();
+    watcher.runInEventWatcherLoop(
+        [&]() { ran.store(true, std::memory_order_release); });
+    while (!ran.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+    samples.push_back(std::chrono::duration<double, std::micro>(
+                          std::chrono::steady_clock::now() - start)
+                          .count());
+  }
+
+  state.counters["p50(us)"] = bits::Histogram<50, 100>()(samples);
+  state.counters["p99(us)"] = bits::Histogram<99, 100>()(samples);
+}
+
+// Tasks posted by 'producers' threads at once, until all of them ran
+template <typename Watcher>
+static void BM_PostThroughput(benchmark::State& state) {
+  const auto producers    = static_cast<size_t>(state.range(0));
+  const auto per_producer = static_cast<size_t>(state.range(1));
+
+  Watcher watcher;
+  for (auto _ : state) {
+    std::atomic<size_t> executed{0};
+    std::latch done(1);
+    std::latch start(static_cast<ptrdiff_t>(producers));
+
+    std::vector<std::thread> threads;
+    threads.reserve(producers);
+    for (size_t p = 0; p < producers; ++p) {
+      threads.emplace_back([&]() {
+        start.arrive_and_wait();
+        for (size_t i = 0; i < per_producer; ++i) {
+          watcher.runInEventWatcherLoop([&]() {
+            if (executed.fetch_add(1) + 1 == producers * per_producer) {
+              done.count_down();
+            }
+          });
+        }
+      });
+    }
+    done.wait();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() *
+                                               producers * per_producer));
+}
+
+// Registering and removing 'fds' read watches, each in its own loop
+// iteration so every change reaches the kernel
+template <typename Watcher>
+static void BM_WatchUnwatchChurn(benchmark::State& state) {
+  const auto count = static_cast<size_t>(state.range(0));
+  if (!reserveFds(count + 64)) {
+    state.SkipWithError("RLIMIT_NOFILE too low");
+    return;
+  }
+
+  Fds fds;
+  const int idle_read = fds.pipe().first;
+  std::vector<int> watched;
+  watched.reserve(count);
+  for (size_t i = 0; i < count; ++i) {
+    watched.push_back(fds.dup(idle_read));
+  }
+
+  Watcher watcher;
+  for (auto _ : state) {
+    runOnLoop(watcher, [&]() {
+      for (const int fd : watched) {
+        watcher.watch(fd, RDONLY, []() {});
+      }
+    });
+    unwatchAllRead(watcher, watched);
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * count * 2));
+}
+
+// 'registered' read watches of which 'active' become ready per iteration;
+// idle ones are dups of a pipe nobody writes to
+template <typename Watcher>
+static void BM_DispatchActiveAmongIdle(benchmark::State& state) {
+  const auto registered = static_cast<size_t>(state.range(0));
+  const auto active     = static_cast<size_t>(state.range(1));
+  if (!reserveFds(registered + 2 * active + 64)) {
+    state.SkipWithError("RLIMIT_NOFILE too low");
+    return;
+  }
+
+  Fds fds;
+  const int idle_read = fds.pipe().first;
+  std::vector<std::pair<int, int>> pipes;
+  for (size_t i = 0; i < active; ++i) {
+    pipes.push_back(fds.pipe());
+  }
+  std::vector<int> idle;
+  for (size_t i = active; i < registered; ++i) {
+    idle.push_back(fds.dup(idle_read));
+  }
+  const auto failed = [](const int fd) { return fd < 0; };
+  if (failed(idle_read) || std::ranges::any_of(idle, failed) ||
+      std::ranges::any_of(pipes, failed, &std::pair<int, int>::first)) {
+    state.SkipWithError("Out of fds");
+    return;
+  }
+
+  Watcher watcher;
+  std::atomic<size_t> dispatched{0};
+  std::atomic<bool> round_done{false};
+  std::vector<int> watched;
+  runOnLoop(watcher, [&]() {
+    for (const auto& pipe : pipes) {
+      watched.push_back(pipe.first);
+      watcher.watch(pipe.first, RDONLY, [&, fd = pipe.first]() {
+        char byte;
+        if (::read(fd, &byte, 1) == 1 &&
+            dispatched.fetch_add(1) + 1 == active) {
+          round_done.store(true, std::memory_order_release);
+        }
+      });
+    }
+    for (const int fd : idle) {
+      watched.push_back(fd);
+      watcher.watch(fd, RDONLY, []() {});
+    }
+  });
+
+  for (auto _ : state) {
+    dispatched.store(0);
+    round_done.store(false);
+    for (const auto& pipe : pipes) {
+      benchmark::DoNotOptimize(::write(pipe.second, "x", 1));
+    }
+    while (!round_done.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+    }
+  }
+
+  unwatchAllRead(watcher, watched);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * active));
+}
+
+BENCHMARK_TEMPLATE(BM_PostLatency, EventWatcher)
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(100000);
+BENCHMARK_TEMPLATE(BM_PostLatency, UringEventWatcher)
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(100000);
+
+BENCHMARK_TEMPLATE(BM_PostThroughput, EventWatcher)
+    ->ArgNames({"producers", "tasks"})
+    ->Args({1, 100000})
+    ->Args({4, 25000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PostThroughput, UringEventWatcher)
+    ->ArgNames({"producers", "tasks"})
+    ->Args({1, 100000})
+    ->Args({4, 25000})
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_WatchUnwatchChurn, EventWatcher)
+    ->ArgName("fds")
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_WatchUnwatchChurn, UringEventWatcher)
+    ->ArgName("fds")
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_DispatchActiveAmongIdle, EventWatcher)
+    ->ArgNames({"fds", "active"})
+    ->Args({10000, 1})
+    ->Args({10000, 100})
+    ->Args({100000, 1})
+    ->Args({100000, 100})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+BENCHMARK_TEMPLATE(BM_DispatchActiveAmongIdle, UringEventWatcher)
+    ->ArgNames({"fds", "active"})
+    ->Args({10000, 1})
+    ->Args({10000, 100})
+    ->Args({100000, 1})
+    ->Args({100000, 100})
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+int main(int argc, char** argv) {
+  bits::ttl::Ttl::init("discard://");
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    bits::ttl::Ttl::shutdown();
+    return 1;
+  }
+  benchmark::RunSpecifiedBenchmarks();
+  bits::ttl::Ttl::shutdown();
+  return 0;
+}
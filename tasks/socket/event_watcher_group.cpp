@@ -0,0 +1,140 @@
+#include "event_watcher_group.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <bits/ttl/logger.hpp>
+#include <cassert>
+#include <cstddef>
+#include <latch>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace getrafty::io {
+
+namespace {
+std::vector<int> allowedCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (::sched_getaffinity(0, sizeof(set), &set) == -1) {
+    return {};
+  }
+
+  std::vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+}  // namespace
+
+EventWatcherGroup::Lease::Lease(Lease&& that) noexcept
+    : group_(std::exchange(that.group_, nullptr)), index_(that.index_) {}
+
+EventWatcherGroup::Lease& EventWatcherGroup::Lease::operator=(
+    Lease&& that) noexcept {
+  if (this != &that) {
+    if (group_ != nullptr) {
+      group_->loops_[index_]->leases.fetch_sub(1, std::memory_order_relaxed);
+    }
+    group_ = std::exchange(that.group_, nullptr);
+    index_ = that.index_;
+  }
+  return *this;
+}
+
+EventWatcherGroup::Lease::~Lease() {
+  if (group_ != nullptr) {
+    group_->loops_[index_]->leases.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+EventWatcher& EventWatcherGroup::Lease::watcher() const {
+  assert(group_ != nullptr && "Lease was moved from");
+  return group_->at(index_);
+}
+
+EventWatcherGroup::EventWatcherGroup(const size_t size,
+                                     const bool pin_to_cores) {
+  if (size == 0) {
+    throw std::invalid_argument("EventWatcherGroup: size must be positive");
+  }
+
+  loops_.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    auto loop     = std::make_unique<Loop>();
+    loop->watcher = std::make_unique<EventWatcher>();
+    loops_.push_back(std::move(loop));
+  }
+
+  if (!pin_to_cores) {
+    return;
+  }
+
+  const auto cpus = allowedCpus();
+  if (cpus.empty()) {
+    return;
+  }
+  // Loops are pinned by the time the constructor returns
+  std::latch pinned(static_cast<ptrdiff_t>(size));
+  for (size_t i = 0; i < size; ++i) {
+    const int cpu = cpus[i % cpus.size()];
+    runInLoop(i, [cpu, &pinned] {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) !=
+          0) {
+        TTL_LOG(bits::ttl::Error) << "Failed to pin loop to cpu " << cpu;
+      }
+      pinned.count_down();
+    });
+  }
+  pinned.wait();
+}
+
+EventWatcher& EventWatcherGroup::at(const size_t index) const {
+  assert(index < loops_.size());
+  return *loops_[index]->watcher;
+}
+
+size_t EventWatcherGroup::indexFor(const int fd) const {
+  // Consecutive fds land on consecutive loops
+  return static_cast<size_t>(fd) % loops_.size();
+}
+
+EventWatcherGroup::Lease EventWatcherGroup::acquire() {
+  size_t best      = 0;
+  size_t best_load = loops_[0]->leases.load(std::memory_order_relaxed);
+  for (size_t i = 1; i < loops_.size(); ++i) {
+    const auto current = loops_[i]->leases.load(std::memory_order_relaxed);
+    if (current < best_load) {
+      best      = i;
+      best_load = current;
+    }
+  }
+  return lease(best);
+}
+
+EventWatcherGroup::Lease EventWatcherGroup::acquire(const size_t key) {
+  return lease(key % loops_.size());
+}
+
+size_t EventWatcherGroup::load(const size_t index) const {
+  return loops_[index]->leases.load(std::memory_order_relaxed);
+}
+
+void EventWatcherGroup::runInLoop(const size_t index,
+                                  WatchCallback task) const {
+  at(index).runInEventWatcherLoop(std::move(task));
+}
+
+EventWatcherGroup::Lease EventWatcherGroup::lease(const size_t index) {
+  loops_[index]->leases.fetch_add(1, std::memory_order_relaxed);
+  return {this, index};
+}
+
+}  // namespace getrafty::io
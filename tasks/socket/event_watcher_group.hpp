@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "event_watcher.hpp"
+
+namespace getrafty::io {
+
+// Fixed set of independent EventWatcher loops, one per core by default.
+//
+// Every fd lives on exactly one loop for its whole life, so its callbacks
+// never race with each other and need no locking. A Socket is pinned to a
+// loop by constructing it with that loop's watcher. TcpTransport listens
+// with SO_REUSEPORT, so servers that want all loops to accept bind one
+// Socket per loop to the same address and the kernel spreads incoming
+// connections between them.
+class EventWatcherGroup {
+ public:
+  // Keeps one unit of load accounted to a loop while alive
+  class Lease {
+   public:
+    // Non-copyable
+    Lease(const Lease&) = delete;
+
+    Lease& operator=(const Lease&) = delete;
+
+    Lease(Lease&& that) noexcept;
+
+    Lease& operator=(Lease&& that) noexcept;
+
+    ~Lease();
+
+    [[nodiscard]] size_t index() const { return index_; }
+
+    // Not on a moved-from lease
+    [[nodiscard]] EventWatcher& watcher() const;
+
+   private:
+    friend class EventWatcherGroup;
+
+    Lease(EventWatcherGroup* group, size_t index)
+        : group_(group), index_(index) {}
+
+    EventWatcherGroup* group_;
+    size_t index_;
+  };
+
+  explicit EventWatcherGroup(size_t size = defaultSize(),
+                             bool pin_to_cores = false);
+
+  // Non-copyable
+  EventWatcherGroup(const EventWatcherGroup&) = delete;
+
+  EventWatcherGroup& operator=(const EventWatcherGroup&) = delete;
+
+  // Non-movable
+  EventWatcherGroup(EventWatcherGroup&&) = delete;
+
+  // No lease may be alive and no loop may still post to its siblings,
+  // loops are destroyed one by one
+  ~EventWatcherGroup() = default;
+
+  static size_t defaultSize() {
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  [[nodiscard]] size_t size() const { return loops_.size(); }
+
+  [[nodiscard]] EventWatcher& at(size_t index) const;
+
+  // Stateless placement, same fd always maps to the same loop
+  [[nodiscard]] size_t indexFor(int fd) const;
+
+  [[nodiscard]] EventWatcher& forFd(int fd) const { return at(indexFor(fd)); }
+
+  // Loop with fewest live leases at the time of the call
+  [[nodiscard]] Lease acquire();
+
+  // Loop picked by hashing 'key', e.g. a peer address or a connection id
+  [[nodiscard]] Lease acquire(size_t key);
+
+  [[nodiscard]] size_t load(size_t index) const;
+
+  // Cross-loop posting, e.g. to hand a result to the loop that owns a fd
+  void runInLoop(size_t index, WatchCallback task) const;
+
+ private:
+  struct Loop {
+    std::unique_ptr<EventWatcher> watcher;
+    std::atomic<size_t> leases{0};
+  };
+
+  Lease lease(size_t index);
+
+  std::vector<std::unique_ptr<Loop>> loops_;
+};
+
+}  // namespace getrafty::io
@@ -0,0 +1,1249 @@
+#include "event_watcher.hpp"
+#include "event_watcher_group.hpp"
+#include "sim_event_watcher.hpp"
+#include "uring_event_watcher.hpp"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std::chrono_literals;
+using namespace getrafty::io;
+
+namespace {
+
+constexpr auto kDispatchTimeout = 1s;
+
+// Counts epoll_wait calls made by the loop
+class CountingEpoll {
+ public:
+  EpollWaitFunc func() {
+    return [calls = calls_](int epoll_fd, epoll_event* events, int max_events,
+                            int timeout_ms) {
+      calls->fetch_add(1);
+      return ::epoll_wait(epoll_fd, events, max_events, timeout_ms);
+    };
+  }
+
+  [[nodiscard]] int calls() const { return calls_->load(); }
+
+ private:
+  std::shared_ptr<std::atomic<int>> calls_ =
+      std::make_shared<std::atomic<int>>(0);
+};
+
+void runAndWait(EventWatcher& watcher, WatchCallback task) {
+  std::promise<void> done;
+  auto future = done.get_future();
+  watcher.runInEventWatcherLoop([&, task = std::move(task)]() mutable {
+    task();
+    done.set_value();
+  });
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+}
+
+// Waits until 'counter' reaches 'expected', then a bit more to catch extras
+void expectCount(const std::atomic<int>& counter, int expected) {
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (counter.load() < expected &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  std::this_thread::sleep_for(20ms);
+  EXPECT_EQ(counter.load(), expected);
+}
+
+}  // namespace
+
+class EventWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    watcher_ = std::make_unique<EventWatcher>(epoll_.func());
+  }
+
+  void TearDown() override { watcher_.reset(); }
+
+  CountingEpoll epoll_;
+  std::unique_ptr<EventWatcher> watcher_;
+};
+
+TEST_F(EventWatcherTest, TaskPostedToIdleLoopRuns) {
+  // Let the loop go to sleep first
+  std::this_thread::sleep_for(20ms);
+
+  std::atomic<bool> ran{false};
+  runAndWait(*watcher_, [&]() { ran = true; });
+
+  EXPECT_TRUE(ran.load());
+}
+
+TEST_F(EventWatcherTest, WakeupsCoalescedWhileLoopBusy) {
+  constexpr int kTasks = 1000;
+  // One iteration drains them all
+  watcher_->setIterationBudget(kTasks);
+
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+
+  const int calls_before = epoll_.calls();
+
+  std::atomic<int> executed{0};
+  std::promise<void> all_done;
+  for (int i = 0; i < kTasks; ++i) {
+    watcher_->runInEventWatcherLoop([&]() {
+      if (executed.fetch_add(1) + 1 == kTasks) {
+        all_done.set_value();
+      }
+    });
+  }
+  release.count_down();
+
+  auto future = all_done.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+
+  // Loop was awake the whole time: no doorbell, so no extra wait cycles
+  EXPECT_LE(epoll_.calls() - calls_before, 2);
+}
+
+TEST_F(EventWatcherTest, ConcurrentProducersAllTasksRun) {
+  constexpr int kProducers        = 4;
+  constexpr int kTasksPerProducer = 5000;
+
+  std::atomic<int> executed{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&]() {
+      for (int i = 0; i < kTasksPerProducer; ++i) {
+        watcher_->runInEventWatcherLoop([&]() { executed.fetch_add(1); });
+        if (i % 100 == 0) {
+          // Give the loop a chance to fall asleep in between
+          std::this_thread::sleep_for(100us);
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (executed.load() < kProducers * kTasksPerProducer &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_EQ(executed.load(), kProducers * kTasksPerProducer);
+}
+
+TEST_F(EventWatcherTest, ReadCallbackCalledWhenReady) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+  const int read_end  = fds[0];
+  const int write_end = fds[1];
+
+  std::promise<void> fired;
+  watcher_->watch(read_end, RDONLY, [&, read_end]() {
+    char byte;
+    ::read(read_end, &byte, 1);
+    fired.set_value();
+  });
+  ASSERT_EQ(::write(write_end, "x", 1), 1);
+
+  auto future = fired.get_future();
+  EXPECT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(read_end, RDONLY); });
+  ::close(read_end);
+  ::close(write_end);
+}
+
+TEST_F(EventWatcherTest, DestroyWhileLoopSleeps) {
+  std::this_thread::sleep_for(20ms);
+
+  const auto start = std::chrono::steady_clock::now();
+  watcher_.reset();
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, kDispatchTimeout);
+}
+
+TEST_F(EventWatcherTest, CallbackMayUnwatchAndReplaceItself) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+  const int read_end = fds[0];
+
+  std::promise<std::string> seen;
+  watcher_->watch(read_end, RDONLY,
+                  [&, read_end, tag = std::string(64, 'a')]() {
+                    watcher_->watch(read_end, RDONLY, []() {});
+                    watcher_->unwatch(read_end, RDONLY);
+                    // Captures must survive both
+                    seen.set_value(tag);
+                  });
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+
+  auto future = seen.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_EQ(future.get(), std::string(64, 'a'));
+
+  runAndWait(*watcher_, []() {});
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, StaleEventNotDeliveredToReusedFd) {
+  int first[2];
+  int second[2];
+  ASSERT_EQ(::pipe2(first, O_NONBLOCK), 0);
+  ASSERT_EQ(::pipe2(second, O_NONBLOCK), 0);
+  const std::array<int, 2> read_ends{first[0], second[0]};
+
+  std::atomic<int> stale{0};
+  std::atomic<bool> swapped{false};
+  // Kept open, a pipe without writers reports EPOLLHUP
+  int fresh_write_end = -1;
+  for (size_t i = 0; i < read_ends.size(); ++i) {
+    const int own   = read_ends[i];
+    const int other = read_ends[1 - i];
+    watcher_->watch(own, RDONLY, [&, own, other]() {
+      char byte;
+      ::read(own, &byte, 1);
+      if (swapped.exchange(true)) {
+        return;
+      }
+      // Replace the other fd with a fresh, empty pipe on the same number
+      watcher_->unwatch(other, RDONLY);
+      int fresh[2];
+      ASSERT_EQ(::pipe2(fresh, O_NONBLOCK), 0);
+      ASSERT_EQ(::dup3(fresh[0], other, O_CLOEXEC), other);
+      ::close(fresh[0]);
+      fresh_write_end = fresh[1];
+      watcher_->watch(other, RDONLY, [&]() { stale.fetch_add(1); });
+    });
+  }
+  runAndWait(*watcher_, []() {});
+
+  // Both fds become ready while the loop is busy, so they share a batch
+  std::latch release(1);
+  watcher_->runInEventWatcherLoop([&]() { release.wait(); });
+  ASSERT_EQ(::write(first[1], "x", 1), 1);
+  ASSERT_EQ(::write(second[1], "x", 1), 1);
+  release.count_down();
+
+  runAndWait(*watcher_, []() {});
+  std::this_thread::sleep_for(20ms);
+  EXPECT_TRUE(swapped.load());
+  EXPECT_EQ(stale.load(), 0);
+
+  runAndWait(*watcher_, [&]() {
+    watcher_->unwatch(read_ends[0], RDONLY);
+    watcher_->unwatch(read_ends[1], RDONLY);
+  });
+  for (const int fd :
+       {first[0], first[1], second[0], second[1], fresh_write_end}) {
+    ::close(fd);
+  }
+}
+
+TEST_F(EventWatcherTest, LevelTriggeredRepeatsUntilDrained) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::atomic<int> fired{0};
+  watcher_->watch(fds[0], RDONLY, [&]() { fired.fetch_add(1); });
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (fired.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_GE(fired.load(), 2);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, EdgeTriggeredFiresOncePerArrival) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  // Never drains, level-triggered would fire in a loop
+  std::atomic<int> fired{0};
+  watcher_->watch(fds[0], RDONLY | EDGE, [&]() { fired.fetch_add(1); });
+  runAndWait(*watcher_, []() {});
+
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(fired, 1);
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(fired, 2);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, OneShotFiresOnceUntilRewatched) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::atomic<int> fired{0};
+  auto callback = [&]() { fired.fetch_add(1); };
+  watcher_->watch(fds[0], RDONLY | ONESHOT, callback);
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(fired, 1);
+
+  // Still readable, re-arming reports it again
+  watcher_->watch(fds[0], RDONLY | ONESHOT, callback);
+  expectCount(fired, 2);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, OneShotKeepsOtherDirectionArmed) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  // Writable right away, which disarms the whole fd in the kernel
+  std::atomic<int> writes{0};
+  watcher_->watch(fds[0], WRONLY | ONESHOT, [&]() { writes.fetch_add(1); });
+  std::atomic<int> reads{0};
+  watcher_->watch(fds[0], RDONLY | ONESHOT, [&]() { reads.fetch_add(1); });
+  expectCount(writes, 1);
+
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(reads, 1);
+  EXPECT_EQ(writes.load(), 1);
+
+  runAndWait(*watcher_, [&]() {
+    watcher_->unwatch(fds[0], RDONLY);
+    watcher_->unwatch(fds[0], WRONLY);
+  });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, OneShotMismatchAcrossDirectionsRejected) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  std::atomic<int> reads{0};
+  watcher_->watch(fds[0], RDONLY | ONESHOT, [&]() { reads.fetch_add(1); });
+  // Always writable, would fire on every wait if accepted
+  std::atomic<int> writes{0};
+  watcher_->watch(fds[0], WRONLY, [&]() { writes.fetch_add(1); });
+
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(reads, 1);
+  EXPECT_EQ(writes.load(), 0);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, ModifierAppliesOnlyIfAllDirectionsAskForIt) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  std::atomic<int> reads{0};
+  watcher_->watch(fds[0], RDONLY | EDGE, [&]() { reads.fetch_add(1); });
+  // Level-triggered writer makes the whole registration level-triggered
+  std::atomic<int> writes{0};
+  watcher_->watch(fds[0], WRONLY, [&]() {
+    if (writes.fetch_add(1) == 0) {
+      ASSERT_EQ(::write(fds[1], "x", 1), 1);
+    }
+  });
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (reads.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_GE(reads.load(), 2);
+
+  runAndWait(*watcher_, [&]() {
+    watcher_->unwatch(fds[0], RDONLY);
+    watcher_->unwatch(fds[0], WRONLY);
+  });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, ChangesWithinIterationCollapse) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  // Write end is always writable, any registration that reaches the kernel
+  // would fire
+  std::atomic<int> calls{0};
+  runAndWait(*watcher_, [&]() {
+    for (int i = 0; i < 100; ++i) {
+      watcher_->watch(fds[1], WRONLY, [&]() { calls.fetch_add(1); });
+      watcher_->unwatch(fds[1], WRONLY);
+    }
+  });
+  expectCount(calls, 0);
+
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, EdgeRewatchWithinIterationSeesPendingData) {
+  int fds[2];
+  ASSERT_EQ(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds), 0);
+
+  // Write side keeps the fd registered while read side is replaced
+  std::atomic<int> writable{0};
+  std::atomic<int> first{0};
+  std::atomic<int> second{0};
+  watcher_->watch(fds[0], WRONLY | EDGE, [&]() { writable.fetch_add(1); });
+  watcher_->watch(fds[0], RDONLY | EDGE, [&]() { first.fetch_add(1); });
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(first, 1);
+
+  // Edge already reported, the new watch must still see the byte
+  runAndWait(*watcher_, [&]() {
+    watcher_->unwatch(fds[0], RDONLY);
+    watcher_->watch(fds[0], RDONLY | EDGE, [&]() { second.fetch_add(1); });
+  });
+  expectCount(second, 1);
+  EXPECT_EQ(first.load(), 1);
+
+  runAndWait(*watcher_, [&]() {
+    watcher_->unwatch(fds[0], RDONLY);
+    watcher_->unwatch(fds[0], WRONLY);
+  });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, RunAfterFiresOnceAfterDelay) {
+  constexpr auto kDelay = 30ms;
+
+  std::atomic<int> fired{0};
+  std::promise<void> first;
+  const auto start = std::chrono::steady_clock::now();
+  watcher_->runAfter(kDelay, [&]() {
+    if (fired.fetch_add(1) == 0) {
+      first.set_value();
+    }
+  });
+
+  auto future = first.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, kDelay);
+
+  std::this_thread::sleep_for(2 * kDelay);
+  EXPECT_EQ(fired.load(), 1);
+}
+
+TEST_F(EventWatcherTest, RunEveryFiresUntilCancelled) {
+  std::atomic<int> fired{0};
+  std::promise<void> third;
+  const auto id = watcher_->runEvery(5ms, [&]() {
+    if (fired.fetch_add(1) + 1 == 3) {
+      third.set_value();
+    }
+  });
+
+  auto future = third.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+
+  watcher_->cancel(id);
+  runAndWait(*watcher_, []() {});
+  const int after_cancel = fired.load();
+  std::this_thread::sleep_for(30ms);
+  EXPECT_EQ(fired.load(), after_cancel);
+}
+
+TEST_F(EventWatcherTest, TimersFireInDeadlineOrder) {
+  std::vector<int> order;
+  std::promise<void> done;
+  watcher_->runAfter(30ms, [&]() {
+    order.push_back(3);
+    done.set_value();
+  });
+  watcher_->runAfter(10ms, [&]() { order.push_back(1); });
+  watcher_->runAfter(20ms, [&]() { order.push_back(2); });
+
+  auto future = done.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_EQ(order, (std::vector<int>{1, 2, 3}));
+}
+
+TEST_F(EventWatcherTest, ManyCancelledTimersNeverFire) {
+  constexpr int kTimers = 10000;
+
+  std::atomic<int> fired{0};
+  std::vector<TimerId> ids;
+  ids.reserve(kTimers);
+  for (int i = 0; i < kTimers; ++i) {
+    ids.push_back(watcher_->runAfter(20ms, [&]() { fired.fetch_add(1); }));
+  }
+  for (const auto id : ids) {
+    watcher_->cancel(id);
+  }
+
+  std::promise<void> sentinel;
+  watcher_->runAfter(40ms, [&]() { sentinel.set_value(); });
+  auto future = sentinel.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_EQ(fired.load(), 0);
+}
+
+TEST_F(EventWatcherTest, PendingTimerDoesNotWakeLoopEarly) {
+  std::promise<void> fired;
+  watcher_->runAfter(100ms, [&]() { fired.set_value(); });
+  runAndWait(*watcher_, []() {});
+
+  const int calls_before = epoll_.calls();
+  auto future = fired.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+
+  // One wait that times out at the deadline, one to run the timer
+  EXPECT_LE(epoll_.calls() - calls_before, 2);
+}
+
+TEST_F(EventWatcherTest, DispatchOnLoopThreadRunsInline) {
+  EXPECT_FALSE(watcher_->isInLoopThread());
+
+  bool in_loop    = false;
+  bool ran        = false;
+  bool ran_inline = false;
+  runAndWait(*watcher_, [&]() {
+    in_loop = watcher_->isInLoopThread();
+    watcher_->dispatch([&]() { ran = true; });
+    ran_inline = ran;
+  });
+
+  EXPECT_TRUE(in_loop);
+  EXPECT_TRUE(ran_inline);
+}
+
+TEST_F(EventWatcherTest, DispatchFromOtherThreadIsQueued) {
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+
+  std::atomic<bool> ran{false};
+  watcher_->dispatch([&]() { ran = true; });
+  EXPECT_FALSE(ran.load());
+
+  release.count_down();
+  runAndWait(*watcher_, []() {});
+  EXPECT_TRUE(ran.load());
+}
+
+TEST_F(EventWatcherTest, StatsCoverCallbacksAndTasks) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::atomic<int> reads{0};
+  watcher_->watch(fds[0], RDONLY, [&]() {
+    char byte;
+    ::read(fds[0], &byte, 1);
+    reads.fetch_add(1);
+  });
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(reads, 1);
+  runAndWait(*watcher_, []() {});
+
+  const auto stats = watcher_->stats();
+  EXPECT_GT(stats.iterations, 0u);
+  EXPECT_GT(stats.iteration_us.count, 0u);
+  EXPECT_EQ(stats.callback_us.count, 1u);
+  EXPECT_GT(stats.task_queue_depth.count, 0u);
+  EXPECT_GT(stats.task_delay_us.count, 0u);
+  EXPECT_EQ(stats.stalls, 0u);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, WatchdogReportsBlockedLoop) {
+  std::promise<StallReport> reported;
+  std::atomic<bool> once{false};
+  watcher_->startWatchdog(20ms, [&](const StallReport& report) {
+    if (!once.exchange(true)) {
+      reported.set_value(report);
+    }
+  });
+
+  runAndWait(*watcher_, []() { std::this_thread::sleep_for(100ms); });
+
+  auto future = reported.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  const auto report = future.get();
+  EXPECT_GE(report.duration, 20ms);
+  EXPECT_FALSE(report.stack.empty());
+  EXPECT_GE(watcher_->stats().stalls, 1u);
+
+  // Loop survives the signal and idles without further reports
+  watcher_->stopWatchdog();
+  runAndWait(*watcher_, []() {});
+}
+
+TEST_F(EventWatcherTest, BusyPollSpinsThenBlocks) {
+  watcher_->setBusyPoll(20ms);
+  runAndWait(*watcher_, []() {});
+  const int calls_before = epoll_.calls();
+
+  // Tasks posted while the loop spins still run
+  for (int i = 0; i < 10; ++i) {
+    runAndWait(*watcher_, []() {});
+  }
+
+  // Idle: spins shrink and the loop falls back to blocking
+  std::this_thread::sleep_for(100ms);
+  const int calls_idle = epoll_.calls();
+  EXPECT_GT(calls_idle - calls_before, 10);
+  std::this_thread::sleep_for(50ms);
+  EXPECT_EQ(epoll_.calls(), calls_idle);
+
+  watcher_->setBusyPoll(0ms);
+  runAndWait(*watcher_, []() {});
+}
+
+TEST_F(EventWatcherTest, TaskFloodDoesNotStarveReadyFds) {
+  constexpr int kBudget = 16;
+  constexpr int kTasks  = 8 * kBudget;
+  watcher_->setIterationBudget(kBudget);
+
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+  std::atomic<int> executed{0};
+  std::atomic<int> executed_before_read{-1};
+  watcher_->watch(fds[0], RDONLY, [&]() {
+    watcher_->unwatch(fds[0], RDONLY);
+    executed_before_read.store(executed.load());
+  });
+  runAndWait(*watcher_, []() {});
+
+  // Flood the queue and make the fd ready while the loop is busy
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+  for (int i = 0; i < kTasks; ++i) {
+    watcher_->runInEventWatcherLoop([&]() { executed.fetch_add(1); });
+  }
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  release.count_down();
+
+  runAndWait(*watcher_, []() {});
+  EXPECT_EQ(executed.load(), kTasks);
+  // Read is served after a couple of budgets, not after the whole flood
+  EXPECT_GE(executed_before_read.load(), 0);
+  EXPECT_LE(executed_before_read.load(), 2 * kBudget);
+
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(EventWatcherTest, EventBudgetCarriesReadyFdsOver) {
+  watcher_->setIterationBudget(EventWatcher::kDefaultTaskBudget, 1);
+
+  constexpr int kPipes = 4;
+  std::array<std::array<int, 2>, kPipes> pipes{};
+  std::atomic<int> reads{0};
+  for (auto& fds : pipes) {
+    ASSERT_EQ(::pipe2(fds.data(), O_NONBLOCK), 0);
+    watcher_->watch(fds[0], RDONLY, [&, fd = fds[0]]() {
+      char byte;
+      ::read(fd, &byte, 1);
+      reads.fetch_add(1);
+    });
+  }
+  runAndWait(*watcher_, []() {});
+
+  for (const auto& fds : pipes) {
+    ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  }
+  expectCount(reads, kPipes);
+
+  runAndWait(*watcher_, [&]() {
+    for (const auto& fds : pipes) {
+      watcher_->unwatch(fds[0], RDONLY);
+    }
+  });
+  for (const auto& fds : pipes) {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+}
+
+TEST_F(EventWatcherTest, BeforeWaitHookRunsOncePerIteration) {
+  std::mutex mutex;
+  std::string trace;
+  auto append = [&](const char c) {
+    std::lock_guard lock(mutex);
+    trace += c;
+  };
+  auto snapshot = [&]() {
+    std::lock_guard lock(mutex);
+    return trace;
+  };
+
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+  const auto id = watcher_->onBeforeWait([&]() { append('h'); });
+  for (int i = 0; i < 3; ++i) {
+    watcher_->runInEventWatcherLoop([&]() { append('t'); });
+  }
+  release.count_down();
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (snapshot().find('h') == std::string::npos &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  // Tasks of one iteration are followed by a single hook call
+  EXPECT_EQ(snapshot().substr(0, 4), "ttth");
+
+  watcher_->removeBeforeWait(id);
+  runAndWait(*watcher_, []() {});
+  const auto before = snapshot();
+  runAndWait(*watcher_, []() {});
+  runAndWait(*watcher_, []() {});
+  EXPECT_EQ(snapshot(), before);
+}
+
+TEST_F(EventWatcherTest, BeforeWaitHookMayRemoveItself) {
+  std::atomic<int> calls{0};
+  auto id = std::make_shared<HookId>(kInvalidHook);
+  runAndWait(*watcher_, [&]() {
+    *id = watcher_->onBeforeWait([&, id]() {
+      calls.fetch_add(1);
+      watcher_->removeBeforeWait(*id);
+    });
+  });
+  runAndWait(*watcher_, []() {});
+  runAndWait(*watcher_, []() {});
+  expectCount(calls, 1);
+}
+
+TEST_F(EventWatcherTest, ReadyFdsDispatchedByPriority) {
+  std::mutex mutex;
+  std::string trace;
+  auto snapshot = [&]() {
+    std::lock_guard lock(mutex);
+    return trace;
+  };
+
+  // Registered low first, so kernel order alone would not do
+  constexpr std::array<std::pair<WatchFlag, char>, 3> kClasses{
+      {{LOW_PRIORITY, 'l'}, {RDONLY, 'n'}, {HIGH_PRIORITY, 'h'}}};
+  std::array<std::array<int, 2>, 3> pipes{};
+  for (size_t i = 0; i < pipes.size(); ++i) {
+    ASSERT_EQ(::pipe2(pipes[i].data(), O_NONBLOCK), 0);
+    watcher_->watch(pipes[i][0], RDONLY | kClasses[i].first,
+                    [&, fd = pipes[i][0], c = kClasses[i].second]() {
+                      char byte;
+                      ::read(fd, &byte, 1);
+                      std::lock_guard lock(mutex);
+                      trace += c;
+                    });
+  }
+
+  // All three become ready while the loop is busy, one batch gets them
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+  for (const auto& fds : pipes) {
+    ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  }
+  release.count_down();
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (snapshot().size() < 3 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_EQ(snapshot(), "hnl");
+
+  runAndWait(*watcher_, [&]() {
+    for (const auto& fds : pipes) {
+      watcher_->unwatch(fds[0], RDONLY);
+    }
+  });
+  for (const auto& fds : pipes) {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+}
+
+TEST_F(EventWatcherTest, LowPriorityBudgetHoldsEventsBack) {
+  watcher_->setIterationBudget(EventWatcher::kDefaultTaskBudget, 0, 1);
+
+  std::mutex mutex;
+  std::string trace;
+  auto append = [&](const char c) {
+    std::lock_guard lock(mutex);
+    trace += c;
+  };
+  auto snapshot = [&]() {
+    std::lock_guard lock(mutex);
+    return trace;
+  };
+
+  // Edge-triggered: an event held back and then lost never comes again
+  constexpr int kLow = 3;
+  std::array<std::array<int, 2>, kLow + 1> pipes{};
+  for (size_t i = 0; i < pipes.size(); ++i) {
+    ASSERT_EQ(::pipe2(pipes[i].data(), O_NONBLOCK), 0);
+    const auto priority = i == kLow ? HIGH_PRIORITY : LOW_PRIORITY;
+    watcher_->watch(pipes[i][0], RDONLY | EDGE | priority,
+                    [&, fd = pipes[i][0], c = i == kLow ? 'h' : 'l']() {
+                      char byte;
+                      while (::read(fd, &byte, 1) == 1) {
+                      }
+                      append(c);
+                    });
+  }
+  const auto id = watcher_->onBeforeWait([&]() { append('|'); });
+
+  std::latch release(1);
+  std::promise<void> blocked;
+  watcher_->runInEventWatcherLoop([&]() {
+    blocked.set_value();
+    release.wait();
+  });
+  blocked.get_future().wait();
+  for (const auto& fds : pipes) {
+    ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  }
+  release.count_down();
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (std::ranges::count(snapshot(), 'l') < kLow &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  // One low-priority callback per iteration, each exactly once
+  EXPECT_NE(snapshot().find("hl|l|l|"), std::string::npos) << snapshot();
+
+  watcher_->removeBeforeWait(id);
+  runAndWait(*watcher_, [&]() {
+    for (const auto& fds : pipes) {
+      watcher_->unwatch(fds[0], RDONLY);
+    }
+  });
+  EXPECT_EQ(std::ranges::count(snapshot(), 'l'), kLow);
+  for (const auto& fds : pipes) {
+    ::close(fds[0]);
+    ::close(fds[1]);
+  }
+}
+
+TEST(HistogramTest, PercentilesFallIntoLog2Buckets) {
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 100; ++value) {
+    histogram.record(value);
+  }
+  const auto snapshot = histogram.snapshot();
+  EXPECT_EQ(snapshot.count, 100u);
+  EXPECT_EQ(snapshot.max, 100u);
+  EXPECT_DOUBLE_EQ(snapshot.mean(), 50.5);
+  EXPECT_EQ(snapshot.percentile(0.5), 63u);
+  EXPECT_EQ(snapshot.percentile(1.0), 100u);
+  EXPECT_EQ(Histogram{}.snapshot().percentile(0.99), 0u);
+}
+
+TEST(SimEventWatcherTest, TimersFireInVirtualTime) {
+  SimEventWatcher sim;
+  bool fired = false;
+  sim.runAfter(1h, [&]() { fired = true; });
+
+  const auto wall = std::chrono::steady_clock::now();
+  sim.runFor(59min);
+  EXPECT_FALSE(fired);
+  sim.runFor(1min);
+  EXPECT_TRUE(fired);
+  EXPECT_EQ(sim.now().time_since_epoch(), 1h);
+  EXPECT_LT(std::chrono::steady_clock::now() - wall, 1s);
+}
+
+TEST(SimEventWatcherTest, PeriodicTimerNeverGoesIdle) {
+  SimEventWatcher sim;
+  int ticks = 0;
+  const auto id = sim.runEvery(1s, [&]() { ++ticks; });
+
+  sim.runFor(10s);
+  EXPECT_EQ(ticks, 10);
+  EXPECT_FALSE(sim.runUntilIdle(1min));
+  EXPECT_EQ(ticks, 70);
+
+  sim.cancel(id);
+  EXPECT_TRUE(sim.runUntilIdle());
+}
+
+TEST(SimEventWatcherTest, NotifyFiresWatchesOnlyOnce) {
+  SimEventWatcher sim;
+  int reads   = 0;
+  int oneshot = 0;
+  sim.notify(3, RDONLY);
+  sim.watch(3, RDONLY, [&]() { ++reads; });
+  sim.watch(4, WRONLY | ONESHOT, [&]() { ++oneshot; });
+  sim.runUntilIdle();
+  // Nobody watched when it was notified
+  EXPECT_EQ(reads, 0);
+
+  sim.notify(3, RDONLY);
+  sim.notify(3, RDONLY);
+  sim.notify(4, WRONLY);
+  sim.runUntilIdle();
+  sim.notify(4, WRONLY);
+  sim.runUntilIdle();
+  EXPECT_EQ(reads, 1);
+  EXPECT_EQ(oneshot, 1);
+}
+
+TEST(SimEventWatcherTest, SeedDecidesReadyOrder) {
+  auto order = [](const uint64_t seed) {
+    SimEventWatcher sim(seed);
+    std::vector<int> fired;
+    for (int fd = 0; fd < 8; ++fd) {
+      sim.watch(fd, RDONLY, [&fired, fd]() { fired.push_back(fd); });
+    }
+    for (int fd = 0; fd < 8; ++fd) {
+      sim.notify(fd, RDONLY);
+    }
+    sim.runUntilIdle();
+    return fired;
+  };
+
+  EXPECT_EQ(order(7), order(7));
+  std::set<std::vector<int>> seen;
+  for (uint64_t seed = 0; seed < 8; ++seed) {
+    seen.insert(order(seed));
+  }
+  EXPECT_GT(seen.size(), 1u);
+}
+
+TEST(EventWatcherGroupTest, LoopsRunOnDistinctThreads) {
+  EventWatcherGroup group(4);
+  ASSERT_EQ(group.size(), 4);
+
+  std::set<std::thread::id> threads;
+  for (size_t i = 0; i < group.size(); ++i) {
+    runAndWait(group.at(i),
+               [&]() { threads.insert(std::this_thread::get_id()); });
+  }
+  EXPECT_EQ(threads.size(), group.size());
+}
+
+TEST(EventWatcherGroupTest, FdPlacementIsStable) {
+  EventWatcherGroup group(3);
+
+  for (int fd = 0; fd < 16; ++fd) {
+    EXPECT_EQ(group.indexFor(fd), group.indexFor(fd));
+    EXPECT_EQ(&group.forFd(fd), &group.at(group.indexFor(fd)));
+  }
+  EXPECT_NE(group.indexFor(3), group.indexFor(4));
+}
+
+TEST(EventWatcherGroupTest, LeastLoadedSpreadsLeases) {
+  EventWatcherGroup group(3);
+
+  std::vector<EventWatcherGroup::Lease> leases;
+  for (int i = 0; i < 6; ++i) {
+    leases.push_back(group.acquire());
+  }
+  for (size_t i = 0; i < group.size(); ++i) {
+    EXPECT_EQ(group.load(i), 2);
+  }
+
+  // Freed slot is the next one handed out
+  const auto freed = leases[1].index();
+  leases.erase(leases.begin() + 1);
+  EXPECT_EQ(group.load(freed), 1);
+  EXPECT_EQ(group.acquire().index(), freed);
+}
+
+TEST(EventWatcherGroupTest, KeyedLeaseIsSticky) {
+  EventWatcherGroup group(4);
+
+  const auto first  = group.acquire(42);
+  const auto second = group.acquire(42);
+  EXPECT_EQ(first.index(), second.index());
+  EXPECT_EQ(&first.watcher(), &group.at(first.index()));
+  EXPECT_EQ(group.load(first.index()), 2);
+}
+
+TEST(EventWatcherGroupTest, CrossLoopPosting) {
+  constexpr int kRounds = 1000;
+  EventWatcherGroup group(2);
+
+  // Ping-pong a counter between the loops
+  std::atomic<int> hops{0};
+  std::promise<void> done;
+  std::function<void(size_t)> hop = [&](size_t index) {
+    if (hops.fetch_add(1) + 1 == kRounds) {
+      done.set_value();
+      return;
+    }
+    const auto next = 1 - index;
+    group.runInLoop(next, [&, next]() { hop(next); });
+  };
+  group.runInLoop(0, [&]() { hop(0); });
+
+  auto future = done.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_EQ(hops.load(), kRounds);
+
+  // Let the last hop return before 'hop' goes out of scope
+  for (size_t i = 0; i < group.size(); ++i) {
+    runAndWait(group.at(i), []() {});
+  }
+}
+
+TEST(EventWatcherGroupTest, PinnedLoopsStillRunTasks) {
+  EventWatcherGroup group(2, /*pin_to_cores=*/true);
+
+  std::atomic<int> ran{0};
+  std::atomic<int> pinned{0};
+  for (size_t i = 0; i < group.size(); ++i) {
+    runAndWait(group.at(i), [&]() {
+      ran.fetch_add(1);
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      if (::sched_getaffinity(0, sizeof(set), &set) == 0 &&
+          CPU_COUNT(&set) == 1) {
+        pinned.fetch_add(1);
+      }
+    });
+  }
+  EXPECT_EQ(ran.load(), 2);
+  EXPECT_EQ(pinned.load(), 2);
+}
+
+class UringEventWatcherTest : public ::testing::Test {
+ protected:
+  void SetUp() override { watcher_ = std::make_unique<UringEventWatcher>(); }
+
+  void TearDown() override { watcher_.reset(); }
+
+  std::unique_ptr<UringEventWatcher> watcher_;
+};
+
+TEST_F(UringEventWatcherTest, TaskPostedToIdleLoopRuns) {
+  std::this_thread::sleep_for(20ms);
+
+  std::atomic<bool> ran{false};
+  runAndWait(*watcher_, [&]() { ran = true; });
+
+  EXPECT_TRUE(ran.load());
+}
+
+TEST_F(UringEventWatcherTest, ConcurrentProducersAllTasksRun) {
+  constexpr int kProducers        = 4;
+  constexpr int kTasksPerProducer = 5000;
+
+  std::atomic<int> executed{0};
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&]() {
+      for (int i = 0; i < kTasksPerProducer; ++i) {
+        watcher_->runInEventWatcherLoop([&]() { executed.fetch_add(1); });
+        if (i % 100 == 0) {
+          std::this_thread::sleep_for(100us);
+        }
+      }
+    });
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+  while (executed.load() < kProducers * kTasksPerProducer &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(1ms);
+  }
+  EXPECT_EQ(executed.load(), kProducers * kTasksPerProducer);
+}
+
+TEST_F(UringEventWatcherTest, MultishotPollFiresOnEveryWrite) {
+  constexpr int kWrites = 3;
+
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+  const int read_end  = fds[0];
+  const int write_end = fds[1];
+
+  std::atomic<int> fired{0};
+  watcher_->watch(read_end, RDONLY, [&, read_end]() {
+    char byte;
+    while (::read(read_end, &byte, 1) == 1) {
+    }
+    fired.fetch_add(1);
+  });
+
+  for (int i = 0; i < kWrites; ++i) {
+    const int expected = i + 1;
+    ASSERT_EQ(::write(write_end, "x", 1), 1);
+    const auto deadline = std::chrono::steady_clock::now() + kDispatchTimeout;
+    while (fired.load() < expected &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(1ms);
+    }
+    ASSERT_EQ(fired.load(), expected);
+  }
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(read_end, RDONLY); });
+  ::close(read_end);
+  ::close(write_end);
+}
+
+TEST_F(UringEventWatcherTest, WritableFdReportedOnWatch) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::promise<void> fired;
+  watcher_->watch(fds[1], WRONLY, [&]() {
+    fired.set_value();
+    watcher_->unwatch(fds[1], WRONLY);
+  });
+
+  auto future = fired.get_future();
+  EXPECT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+
+  runAndWait(*watcher_, []() {});
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(UringEventWatcherTest, NoCallbackAfterUnwatch) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::atomic<int> fired{0};
+  watcher_->watch(fds[0], RDONLY, [&]() { fired.fetch_add(1); });
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  std::this_thread::sleep_for(20ms);
+  runAndWait(*watcher_, []() {});
+
+  EXPECT_EQ(fired.load(), 0);
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(UringEventWatcherTest, DestroyWhileLoopSleeps) {
+  std::this_thread::sleep_for(20ms);
+
+  const auto start = std::chrono::steady_clock::now();
+  watcher_.reset();
+
+  EXPECT_LT(std::chrono::steady_clock::now() - start, kDispatchTimeout);
+}
+
+TEST_F(UringEventWatcherTest, RunAfterFires) {
+  std::promise<void> fired;
+  const auto start = std::chrono::steady_clock::now();
+  watcher_->runAfter(20ms, [&]() { fired.set_value(); });
+
+  auto future = fired.get_future();
+  ASSERT_EQ(future.wait_for(kDispatchTimeout), std::future_status::ready);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, 20ms);
+}
+
+TEST_F(UringEventWatcherTest, OneShotFiresOnceUntilRewatched) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  std::atomic<int> fired{0};
+  auto callback = [&]() { fired.fetch_add(1); };
+  watcher_->watch(fds[0], RDONLY | ONESHOT, callback);
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(fired, 1);
+
+  watcher_->watch(fds[0], RDONLY | ONESHOT, callback);
+  expectCount(fired, 2);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(UringEventWatcherTest, LevelTriggeredRepeatsUntilDrained) {
+  constexpr int kBytes = 3;
+
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+  ASSERT_EQ(::write(fds[1], "xyz", kBytes), kBytes);
+
+  // Reads one byte per call, the rest must be re-delivered
+  std::atomic<int> fired{0};
+  watcher_->watch(fds[0], RDONLY, [&]() {
+    char byte;
+    if (::read(fds[0], &byte, 1) == 1) {
+      fired.fetch_add(1);
+    }
+  });
+  expectCount(fired, kBytes);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
+
+TEST_F(UringEventWatcherTest, EdgeTriggeredWaitsForNewData) {
+  int fds[2];
+  ASSERT_EQ(::pipe2(fds, O_NONBLOCK), 0);
+
+  // Leaves the byte behind, only the next write reports again
+  std::atomic<int> fired{0};
+  watcher_->watch(fds[0], RDONLY | EDGE, [&]() { fired.fetch_add(1); });
+  ASSERT_EQ(::write(fds[1], "x", 1), 1);
+  expectCount(fired, 1);
+
+  ASSERT_EQ(::write(fds[1], "y", 1), 1);
+  expectCount(fired, 2);
+
+  runAndWait(*watcher_, [&]() { watcher_->unwatch(fds[0], RDONLY); });
+  ::close(fds[0]);
+  ::close(fds[1]);
+}
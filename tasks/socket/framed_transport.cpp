@@ -66,6 +66,11 @@ void FramedTransport::suspendWrite(const Peer& peer) {
   // ==== END YOUR CODE ====
 }
 
+Address FramedTransport::addressOf(const Peer& peer) const {
+  // Framing does not change who is on the other end
+  return transport_->addressOf(peer);
+}
+
 // ==== YOUR CODE: @c261 ====
 
 // ==== END YOUR CODE ====
@@ -7,6 +7,9 @@
 
 namespace getrafty::rpc {
 
+// Length-prefixed messages over another transport. Its write path still
+// builds each frame in one buffer, copying the payload behind the 4-byte
+// header; resumeWritev on the inner transport could send both uncopied.
 class FramedTransport : public ITransport {
  public:
   explicit FramedTransport(std::unique_ptr<ITransport> transport);
@@ -31,6 +34,8 @@ class FramedTransport : public ITransport {
                      IOStatus& out_status) noexcept override;
   void suspendWrite(const Peer& peer) override;
 
+  [[nodiscard]] Address addressOf(const Peer& peer) const override;
+
  private:
   std::unique_ptr<ITransport> transport_;
 
@@ -0,0 +1,269 @@
+#include "loop_monitor.hpp"
+
+#include <execinfo.h>
+#include <signal.h>
+
+#include <algorithm>
+#include <bit>
+#include <bits/ttl/logger.hpp>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace getrafty::io {
+
+namespace {
+
+constexpr int kMaxFrames = 64;
+
+// How long the watchdog waits for the loop thread to answer the signal
+constexpr auto kCaptureTimeout = std::chrono::milliseconds(100);
+
+// Filled by the loop thread from the signal handler. One capture runs at a
+// time across all watchdogs, the buffer outlives them all.
+struct StackCapture {
+  std::array<void*, kMaxFrames> frames{};
+  std::atomic<int> depth{-1};
+  std::atomic<bool> requested{false};
+};
+
+StackCapture capture;
+std::mutex capture_mutex;
+
+int stackSignal() {
+  return SIGRTMIN + 1;
+}
+
+void onStackSignal(int) {
+  const auto saved_errno = errno;
+  if (capture.requested.exchange(false, std::memory_order_acq_rel)) {
+    const int depth = ::backtrace(capture.frames.data(), kMaxFrames);
+    capture.depth.store(depth, std::memory_order_release);
+  }
+  errno = saved_errno;
+}
+
+void installStackHandler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    // First backtrace loads the unwinder, which is not signal-safe
+    std::array<void*, 1> warmup{};
+    ::backtrace(warmup.data(), 1);
+
+    struct sigaction action{};
+    action.sa_handler = &onStackSignal;
+    action.sa_flags   = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(stackSignal(), &action, nullptr) == -1) {
+      TTL_LOG(bits::ttl::Error)
+          << "Failed to install stack capture handler errno=" << errno;
+    }
+  });
+}
+
+std::vector<std::string> captureStack(const pthread_t thread) {
+  std::lock_guard lock(capture_mutex);
+  capture.depth.store(-1, std::memory_order_relaxed);
+  capture.requested.store(true, std::memory_order_release);
+  if (::pthread_kill(thread, stackSignal()) != 0) {
+    capture.requested.store(false, std::memory_order_relaxed);
+    return {};
+  }
+
+  const auto deadline = std::chrono::steady_clock::now() + kCaptureTimeout;
+  int depth           = -1;
+  while ((depth = capture.depth.load(std::memory_order_acquire)) < 0 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  if (depth < 0) {
+    capture.requested.store(false, std::memory_order_relaxed);
+    return {};
+  }
+
+  std::vector<std::string> stack;
+  std::unique_ptr<char*, decltype(&std::free)> symbols{
+      ::backtrace_symbols(capture.frames.data(), depth), &std::free};
+  for (int i = 0; i < depth; ++i) {
+    stack.emplace_back(symbols ? symbols.get()[i] : "?");
+  }
+  return stack;
+}
+
+void logStall(const StallReport& report) {
+  TTL_LOG(bits::ttl::Error)
+      << "Event loop stalled for "
+      << std::chrono::duration_cast<std::chrono::milliseconds>(report.duration)
+             .count()
+      << "ms";
+  for (const auto& frame : report.stack) {
+    TTL_LOG(bits::ttl::Error) << "  " << frame;
+  }
+}
+
+uint64_t micros(const LoopMonitor::Clock::duration elapsed) {
+  const auto us =
+      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  return us > 0 ? static_cast<uint64_t>(us) : 0;
+}
+
+}  // namespace
+
+uint64_t Histogram::Snapshot::percentile(const double q) const {
+  if (count == 0) {
+    return 0;
+  }
+  const auto rank = static_cast<uint64_t>(
+      std::ceil(std::clamp(q, 0.0, 1.0) * static_cast<double>(count)));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= std::max<uint64_t>(rank, 1)) {
+      return i == 0 ? 0 : std::min(max, (uint64_t{1} << i) - 1);
+    }
+  }
+  return max;
+}
+
+void Histogram::record(const uint64_t value) {
+  const auto bucket =
+      std::min<size_t>(std::bit_width(value), kBuckets - 1);
+  // Single writer: plain load and store, no locked read-modify-write
+  const auto add = [](std::atomic<uint64_t>& counter, const uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n,
+                  std::memory_order_relaxed);
+  };
+  add(buckets_[bucket], 1);
+  add(count_, 1);
+  add(sum_, value);
+  if (value > max_.load(std::memory_order_relaxed)) {
+    max_.store(value, std::memory_order_relaxed);
+  }
+}
+
+Histogram::Snapshot Histogram::snapshot() const {
+  Snapshot snapshot;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    snapshot.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+  }
+  snapshot.count = count_.load(std::memory_order_relaxed);
+  snapshot.sum   = sum_.load(std::memory_order_relaxed);
+  snapshot.max   = max_.load(std::memory_order_relaxed);
+  return snapshot;
+}
+
+LoopMonitor::~LoopMonitor() {
+  stopWatchdog();
+}
+
+void LoopMonitor::onWakeup(const Clock::time_point now) {
+  iterations_.fetch_add(1, std::memory_order_relaxed);
+  // Clock epoch is never 0 in practice, 0 is reserved for "waiting"
+  busy_since_.store(std::max<Clock::rep>(now.time_since_epoch().count(), 1),
+                    std::memory_order_relaxed);
+}
+
+void LoopMonitor::onBeforeWait(const Clock::time_point now) {
+  const auto since = busy_since_.exchange(0, std::memory_order_relaxed);
+  if (since != 0) {
+    iteration_us_.record(
+        micros(now - Clock::time_point(Clock::duration(since))));
+  }
+}
+
+void LoopMonitor::onCallback(const Clock::duration elapsed) {
+  callback_us_.record(micros(elapsed));
+}
+
+void LoopMonitor::onTasksDrained(
+    const size_t count, const std::optional<Clock::time_point> posted,
+    const Clock::time_point now) {
+  if (count == 0) {
+    return;
+  }
+  task_queue_depth_.record(count);
+  if (posted) {
+    task_delay_us_.record(micros(now - *posted));
+  }
+}
+
+void LoopMonitor::startWatchdog(const pthread_t loop_thread,
+                                const Clock::duration threshold,
+                                StallHandler handler) {
+  stopWatchdog();
+  installStackHandler();
+
+  loop_thread_ = loop_thread;
+  handler_     = handler ? std::move(handler) : StallHandler(&logStall);
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = false;
+  }
+  watchdog_ = std::make_unique<std::thread>(&LoopMonitor::watchdogLoop, this,
+                                            threshold);
+}
+
+void LoopMonitor::stopWatchdog() {
+  if (!watchdog_) {
+    return;
+  }
+  {
+    std::lock_guard lock(mutex_);
+    stopping_ = true;
+  }
+  stop_cv_.notify_all();
+  watchdog_->join();
+  watchdog_.reset();
+}
+
+LoopStats LoopMonitor::stats() const {
+  return {.iterations       = iterations_.load(std::memory_order_relaxed),
+          .iteration_us     = iteration_us_.snapshot(),
+          .callback_us      = callback_us_.snapshot(),
+          .task_delay_us    = task_delay_us_.snapshot(),
+          .task_queue_depth = task_queue_depth_.snapshot(),
+          .stalls           = stalls_.load(std::memory_order_relaxed)};
+}
+
+void LoopMonitor::watchdogLoop(const Clock::duration threshold) {
+  // Sampling a few times per threshold bounds how late a stall is noticed
+  const auto period = std::max<Clock::duration>(threshold / 4,
+                                                std::chrono::milliseconds(1));
+  Clock::rep reported = 0;
+
+  std::unique_lock lock(mutex_);
+  while (!stop_cv_.wait_for(lock, period, [this] { return stopping_; })) {
+    const auto since = busy_since_.load(std::memory_order_relaxed);
+    if (since == 0 || since == reported) {
+      continue;
+    }
+    const auto elapsed =
+        Clock::now() - Clock::time_point(Clock::duration(since));
+    if (elapsed < threshold) {
+      continue;
+    }
+    // Once per iteration
+    reported = since;
+    lock.unlock();
+    reportStall(elapsed);
+    lock.lock();
+  }
+}
+
+void LoopMonitor::reportStall(const Clock::duration elapsed) {
+  stalls_.fetch_add(1, std::memory_order_relaxed);
+  const StallReport report{.duration = elapsed,
+                           .stack    = captureStack(loop_thread_)};
+  try {
+    handler_(report);
+  } catch (const std::exception& ex) {
+    TTL_LOG(bits::ttl::Error) << "Exception in stall handler: " << ex.what();
+  } catch (...) {
+    TTL_LOG(bits::ttl::Error) << "Unknown exception in stall handler";
+  }
+}
+
+}  // namespace getrafty::io
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+namespace getrafty::io {
+
+// Log2 histogram of non-negative values, recorded by one thread and read by
+// any. Bucket 0 holds zero, bucket i values in [2^(i-1), 2^i).
+class Histogram {
+ public:
+  static constexpr size_t kBuckets = 40;
+
+  struct Snapshot {
+    std::array<uint64_t, kBuckets> buckets{};
+    uint64_t count{0};
+    uint64_t sum{0};
+    uint64_t max{0};
+
+    // Upper bound of the bucket holding quantile 'q' in [0, 1]
+    [[nodiscard]] uint64_t percentile(double q) const;
+
+    [[nodiscard]] double mean() const {
+      return count == 0 ? 0.0 : static_cast<double>(sum) / count;
+    }
+  };
+
+  void record(uint64_t value);
+
+  [[nodiscard]] Snapshot snapshot() const;
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+  std::atomic<uint64_t> max_{0};
+};
+
+// Durations in microseconds
+struct LoopStats {
+  // Loop wakeups so far
+  uint64_t iterations{0};
+  // Work done between two waits: ready callbacks, tasks and timers
+  Histogram::Snapshot iteration_us;
+  Histogram::Snapshot callback_us;
+  // From the first pending task being posted until the loop drains it
+  Histogram::Snapshot task_delay_us;
+  // Tasks run per drain
+  Histogram::Snapshot task_queue_depth;
+  // Iterations reported by the watchdog
+  uint64_t stalls{0};
+};
+
+struct StallReport {
+  std::chrono::nanoseconds duration;
+  // Symbolized frames of the loop thread, empty if it could not be captured
+  std::vector<std::string> stack;
+};
+
+using StallHandler = std::function<void(const StallReport&)>;
+
+// Latency metrics of one event loop and an opt-in stall watchdog.
+//
+// The loop reports when it wakes up and when it is about to block again;
+// the span between is one iteration. Recording costs a couple of clock
+// reads per iteration and callback. The watchdog is a separate thread that
+// samples the start of the running iteration; once it is older than the
+// threshold the loop thread is signalled to capture its own stack, so the
+// report shows what blocks the loop.
+class LoopMonitor {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  LoopMonitor() = default;
+  ~LoopMonitor();
+
+  // Non-copyable
+  LoopMonitor(const LoopMonitor&) = delete;
+
+  LoopMonitor& operator=(const LoopMonitor&) = delete;
+
+  // Non-movable
+  LoopMonitor(LoopMonitor&&) = delete;
+
+  LoopMonitor& operator=(LoopMonitor&&) = delete;
+
+  // Loop thread only
+  void onWakeup(Clock::time_point now);
+  void onBeforeWait(Clock::time_point now);
+  void onCallback(Clock::duration elapsed);
+  void onTasksDrained(size_t count, std::optional<Clock::time_point> posted,
+                      Clock::time_point now);
+
+  // Default handler logs the report, runs on the watchdog thread
+  void startWatchdog(pthread_t loop_thread, Clock::duration threshold,
+                     StallHandler handler);
+  void stopWatchdog();
+
+  [[nodiscard]] LoopStats stats() const;
+
+ private:
+  void watchdogLoop(Clock::duration threshold);
+  void reportStall(Clock::duration elapsed);
+
+  Histogram iteration_us_;
+  Histogram callback_us_;
+  Histogram task_delay_us_;
+  Histogram task_queue_depth_;
+
+  std::atomic<uint64_t> iterations_{0};
+  std::atomic<uint64_t> stalls_{0};
+  // Start of the running iteration in clock ticks, 0 while loop waits
+  std::atomic<Clock::rep> busy_since_{0};
+
+  pthread_t loop_thread_{};
+  StallHandler handler_;
+  std::mutex mutex_;
+  std::condition_variable stop_cv_;
+  bool stopping_{false};
+  std::unique_ptr<std::thread> watchdog_;
+};
+
+}  // namespace getrafty::io
@@ -0,0 +1,139 @@
+#include "sim_event_watcher.hpp"
+
+#include <algorithm>
+#include <bits/ttl/logger.hpp>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace getrafty::io {
+
+namespace {
+void runGuarded(WatchCallback& fn) {
+  if (!fn) {
+    return;
+  }
+  try {
+    fn();
+  } catch (const std::exception& ex) {
+    TTL_LOG(bits::ttl::Error) << "Exception in simulated loop: " << ex.what();
+  } catch (...) {
+    TTL_LOG(bits::ttl::Error) << "Unknown exception in simulated loop";
+  }
+}
+}  // namespace
+
+SimEventWatcher::SimEventWatcher(const uint64_t seed)
+    : EventWatcher(NoLoop{}), random_(seed) {
+  // Whoever drives the simulation is the loop, dispatch runs inline
+  bindLoopThread();
+}
+
+void SimEventWatcher::watch(const int fd, const WatchFlag flag,
+                            WatchCallback callback) {
+  auto& watch    = watches_[{fd, directionOf(flag)}];
+  watch.callback = std::make_shared<WatchCallback>(std::move(callback));
+  watch.oneshot  = (flag & ONESHOT) != 0;
+}
+
+void SimEventWatcher::unwatch(const int fd, const WatchFlag flag) {
+  // Entry in ready_ goes stale and is skipped
+  watches_.erase({fd, directionOf(flag)});
+}
+
+void SimEventWatcher::unwatchAll() {
+  watches_.clear();
+  ready_.clear();
+}
+
+void SimEventWatcher::runInEventWatcherLoop(WatchCallback task) {
+  tasks_.push_back(std::move(task));
+}
+
+void SimEventWatcher::notify(const int fd, const WatchFlag direction) {
+  const W key{fd, directionOf(direction)};
+  const auto it = watches_.find(key);
+  if (it == watches_.end() || std::exchange(it->second.ready, true)) {
+    return;
+  }
+  ready_.push_back(key);
+}
+
+void SimEventWatcher::runUntil(const Clock::time_point deadline) {
+  advance(deadline);
+  now_ = std::max(now_, deadline);
+}
+
+bool SimEventWatcher::runUntilIdle(const Clock::duration limit) {
+  // Idle leaves the clock at the last thing that happened
+  const auto deadline = now_ + limit;
+  if (advance(deadline)) {
+    return true;
+  }
+  now_ = deadline;
+  return false;
+}
+
+bool SimEventWatcher::advance(const Clock::time_point deadline) {
+  bindLoopThread();
+  while (true) {
+    const auto next = runInstant();
+    if (!next) {
+      return true;
+    }
+    if (*next > deadline) {
+      return false;
+    }
+    now_ = std::max(now_, *next);
+  }
+}
+
+std::optional<SimEventWatcher::Clock::time_point>
+SimEventWatcher::runInstant() {
+  while (true) {
+    while (runOne()) {
+    }
+    if (timerQueue().empty()) {
+      return std::nullopt;
+    }
+    const auto next = timerQueue().runExpired(now_);
+    if (tasks_.empty() && ready_.empty()) {
+      return next;
+    }
+  }
+}
+
+bool SimEventWatcher::runOne() {
+  if (!tasks_.empty()) {
+    auto task = std::move(tasks_.front());
+    tasks_.pop_front();
+    runGuarded(task);
+    return true;
+  }
+  if (ready_.empty()) {
+    return false;
+  }
+
+  // Drawn, not first come: the seed decides the interleaving. Plain modulo,
+  // distributions differ between standard libraries and so would replays.
+  const auto pick = static_cast<size_t>(random_() % ready_.size());
+  std::swap(ready_[pick], ready_.back());
+  const auto key = ready_.back();
+  ready_.pop_back();
+
+  const auto it = watches_.find(key);
+  if (it == watches_.end() || !it->second.ready) {
+    // Unwatched since it was notified
+    return true;
+  }
+  it->second.ready = false;
+  // Callback may unwatch itself
+  const auto callback = it->second.callback;
+  if (it->second.oneshot) {
+    watches_.erase(it);
+  }
+  runGuarded(*callback);
+  return true;
+}
+
+}  // namespace getrafty::io
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <random>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "event_watcher.hpp"
+#include "hash.hpp"
+
+namespace getrafty::io {
+
+// EventWatcher on a virtual clock, for deterministic simulation.
+//
+// There is no thread and no kernel behind it: the owner drives the loop by
+// calling run* from one thread, which counts as the loop thread for the
+// lifetime of the watcher. Time stands still while there is work at the
+// current instant and then jumps to the next timer deadline, so simulated
+// seconds pass in microseconds of wall time.
+//
+// Fds are plain numbers. Whatever simulates the device reports readiness
+// with notify(), a watch on that fd and direction then fires within the
+// current instant; notifications nobody watches are dropped. Every watch
+// behaves as if EDGE was given. Posted tasks run in order, ready watches of
+// one instant in an order drawn from the seeded generator, so a seed
+// replays a run exactly and different seeds explore other interleavings.
+//
+// Not thread-safe.
+class SimEventWatcher : public EventWatcher {
+ public:
+  using Clock = TimerQueue::Clock;
+
+  explicit SimEventWatcher(uint64_t seed = 0);
+  ~SimEventWatcher() override = default;
+
+  void watch(int fd, WatchFlag flag, WatchCallback callback) override;
+  void unwatch(int fd, WatchFlag flag) override;
+  void unwatchAll() override;
+  void runInEventWatcherLoop(WatchCallback task) override;
+
+  // Reports 'fd' ready in 'direction'
+  void notify(int fd, WatchFlag direction);
+
+  // Virtual time, starts at the clock epoch
+  [[nodiscard]] Clock::time_point now() const { return now_; }
+
+  // Runs everything due up to 'deadline' and leaves the clock there
+  void runUntil(Clock::time_point deadline);
+  void runFor(Clock::duration duration) { runUntil(now_ + duration); }
+
+  // Runs until no task, ready watch or timer is left. Returns false if
+  // 'limit' of virtual time passes first, e.g. with a periodic timer.
+  bool runUntilIdle(Clock::duration limit = std::chrono::hours(24));
+
+  // Generator of this run, for simulated components that need randomness
+  std::mt19937_64& random() { return random_; }
+
+ protected:
+  [[nodiscard]] Clock::time_point clockNow() const override { return now_; }
+
+ private:
+  using W = std::pair<int, WatchFlag>;
+
+  struct Watch {
+    WatchCallbackPtr callback;
+    bool oneshot{false};
+    // Queued in ready_
+    bool ready{false};
+  };
+
+  // Runs up to 'deadline', true if nothing is left at all
+  bool advance(Clock::time_point deadline);
+  // Runs the current instant dry, returns the next timer deadline
+  std::optional<Clock::time_point> runInstant();
+  bool runOne();
+
+  Clock::time_point now_{};
+  std::mt19937_64 random_;
+
+  std::deque<WatchCallback> tasks_;
+  std::unordered_map<W, Watch, bits::Hash<W>> watches_;
+  std::vector<W> ready_;
+};
+
+}  // namespace getrafty::io
@@ -0,0 +1,287 @@
+#include "sim_transport.hpp"
+
+#include <algorithm>
+#include <string>
+
+#include "bits/ttl/logger.hpp"
+#include "bits/util.hpp"
+
+namespace getrafty::rpc {
+
+SimNetwork::SimNetwork(const Clock::duration latency,
+                       const Clock::duration jitter, const uint64_t seed)
+    : latency_(latency), jitter_(jitter), random_(seed) {}
+
+std::unique_ptr<ITransport> SimNetwork::transport(const Address& address) {
+  const auto id = next_id_++;
+  // Constructor is private, make_unique can not reach it
+  std::unique_ptr<SimTransport> transport(
+      new SimTransport(shared_from_this(), id, address));
+  transports_[id] = transport.get();
+  return transport;
+}
+
+Peer SimNetwork::peerOf(const uint64_t connection) {
+  return {.index      = static_cast<uint32_t>(connection),
+          .generation = static_cast<uint32_t>(connection >> 32) + 1};
+}
+
+SimNetwork::Clock::duration SimNetwork::delay() {
+  if (jitter_ <= Clock::duration::zero()) {
+    return latency_;
+  }
+  const auto spread = static_cast<uint64_t>(jitter_.count()) + 1;
+  return latency_ +
+         Clock::duration(static_cast<Clock::rep>(random_() % spread));
+}
+
+bool SimNetwork::listen(const uint64_t transport, Address& address) {
+  const auto parsed = bits::parseAddress(address);
+  if (!parsed) {
+    return false;
+  }
+  if (parsed->second == 0) {
+    do {
+      address = parsed->first + ":" + std::to_string(next_port_++);
+    } while (listeners_.contains(address));
+  }
+  return listeners_.emplace(address, transport).second;
+}
+
+void SimNetwork::unlisten(const Address& address) {
+  listeners_.erase(address);
+}
+
+void SimNetwork::connect(const uint64_t client, const Address& address) {
+  auto* transport = transports_.at(client);
+  // Handshake takes a round trip
+  transport->ew_->runAfter(
+      delay() + delay(), [weak = weak_from_this(), client, address] {
+        const auto self = weak.lock();
+        if (!self) {
+          return;
+        }
+        const auto client_it = self->transports_.find(client);
+        if (client_it == self->transports_.end()) {
+          return;
+        }
+        const auto listener_it = self->listeners_.find(address);
+        if (listener_it == self->listeners_.end()) {
+          client_it->second->onConnectFailed();
+          return;
+        }
+
+        const auto id = self->next_id_++;
+        auto& links   = self->connections_[id].links;
+        links[0].to   = client;
+        links[1].to   = listener_it->second;
+
+        self->transports_.at(listener_it->second)
+            ->onConnected(id, 1, "sim:" + std::to_string(id));
+        client_it->second->onConnected(id, 0, address);
+      });
+}
+
+bool SimNetwork::send(io::EventWatcher& ew, const uint64_t connection,
+                      const int to, Message message) {
+  const auto it = connections_.find(connection);
+  if (it == connections_.end() || it->second.links[to].to == 0) {
+    return false;
+  }
+  it->second.links[to].in_flight.push_back(std::move(message));
+  // Each timer delivers whatever is first on the link, so jitter reorders
+  // delivery times but never messages
+  ew.runAfter(delay(), [weak = weak_from_this(), connection, to] {
+    if (const auto self = weak.lock()) {
+      self->deliver(connection, to);
+    }
+  });
+  return true;
+}
+
+void SimNetwork::leave(io::EventWatcher& ew, const uint64_t connection,
+                       const int from) {
+  const auto it = connections_.find(connection);
+  if (it == connections_.end()) {
+    return;
+  }
+  auto& links = it->second.links;
+  links[from].to = 0;
+  links[from].in_flight.clear();
+  if (links[1 - from].to == 0) {
+    connections_.erase(it);
+    return;
+  }
+  send(ew, connection, 1 - from, Message{.data = {}, .eof = true});
+}
+
+void SimNetwork::deliver(const uint64_t connection, const int to) {
+  const auto it = connections_.find(connection);
+  if (it == connections_.end()) {
+    return;
+  }
+  auto& link = it->second.links[to];
+  if (link.in_flight.empty()) {
+    // Receiver left and dropped what was in flight
+    return;
+  }
+  auto message = std::move(link.in_flight.front());
+  link.in_flight.pop_front();
+
+  const auto receiver = transports_.find(link.to);
+  if (receiver != transports_.end()) {
+    receiver->second->onDelivered(connection, std::move(message));
+  }
+}
+
+SimTransport::SimTransport(std::shared_ptr<SimNetwork> network,
+                           const uint64_t id, Address address)
+    : network_(std::move(network)), id_(id), address_(std::move(address)) {}
+
+SimTransport::~SimTransport() {
+  close();
+  network_->transports_.erase(id_);
+}
+
+void SimTransport::attach(io::EventWatcher& ew, Fn<IOEvent&&> replay) {
+  ew_     = &ew;
+  replay_ = std::move(replay);
+  TTL_LOG(bits::ttl::Trace) << "(attach) Attached " << address_;
+}
+
+void SimTransport::bind() {
+  if (!network_->listen(id_, address_)) {
+    TTL_LOG(bits::ttl::Error) << "(bind) Address taken " << address_;
+    replay_(BindRep{.status = IOStatus::Fatal, .endpoint = {}});
+    return;
+  }
+  listening_ = true;
+  TTL_LOG(bits::ttl::Trace) << "(bind) Bound " << address_;
+  replay_(BindRep{.status = IOStatus::Ok, .endpoint = address_});
+}
+
+void SimTransport::connect() {
+  network_->connect(id_, address_);
+}
+
+void SimTransport::close() {
+  if (listening_) {
+    network_->unlisten(address_);
+    listening_ = false;
+  }
+  for (const auto& [peer, target] : end_by_peer_) {
+    network_->leave(*ew_, target.connection, target.end);
+  }
+  end_by_peer_.clear();
+  server_peer_.clear();
+  inbox_.clear();
+  read_armed_ = false;
+}
+
+void SimTransport::onConnected(const uint64_t connection, const int end,
+                               const Address& address) {
+  const auto peer    = SimNetwork::peerOf(connection);
+  end_by_peer_[peer] = {
+      .connection = connection, .end = end, .address = address};
+  if (end == 0) {
+    TTL_LOG(bits::ttl::Trace) << "(connect) Connected to " << address;
+    server_peer_ = peer;
+    replay_(ConnectRep{.status = IOStatus::Ok});
+  } else {
+    TTL_LOG(bits::ttl::Trace)
+        << "(accept) Accepted connection from " << address << ", peer=" << peer;
+  }
+}
+
+void SimTransport::onConnectFailed() {
+  TTL_LOG(bits::ttl::Error) << "(connect) Nobody listens on " << address_;
+  replay_(ConnectRep{.status = IOStatus::Fatal});
+}
+
+void SimTransport::onDelivered(const uint64_t connection,
+                               SimNetwork::Message message) {
+  inbox_.push_back(
+      {.peer = SimNetwork::peerOf(connection), .message = std::move(message)});
+  if (read_armed_) {
+    replay_(ReadReadyRep{});
+  }
+}
+
+size_t SimTransport::resumeRead(Buffer& out_data, Peer& out_peer,
+                                IOStatus& out_status, const size_t offset,
+                                const size_t max_len) noexcept {
+  if (inbox_.empty()) {
+    read_armed_ = true;
+    out_status  = IOStatus::WouldBlock;
+    return 0;
+  }
+
+  auto& front = inbox_.front();
+  out_peer    = front.peer;
+  if (front.message.eof) {
+    TTL_LOG(bits::ttl::Trace) << "(read) Peer disconnected, peer=" << out_peer;
+    if (const auto it = end_by_peer_.find(out_peer);
+        it != end_by_peer_.end()) {
+      network_->leave(*ew_, it->second.connection, it->second.end);
+      end_by_peer_.erase(it);
+    }
+    if (server_peer_ == out_peer) {
+      server_peer_.clear();
+    }
+    inbox_.pop_front();
+    out_status = IOStatus::Eof;
+    return 0;
+  }
+
+  const auto& data = front.message.data;
+  const auto left  = data.size() - front.offset;
+  const auto n     = max_len > 0 ? std::min(max_len, left) : left;
+  out_data.resize(offset + n);
+  std::copy_n(data.begin() + static_cast<ptrdiff_t>(front.offset), n,
+              out_data.begin() + static_cast<ptrdiff_t>(offset));
+  front.offset += n;
+  if (front.offset == data.size()) {
+    inbox_.pop_front();
+  }
+  out_status = IOStatus::Ok;
+  return n;
+}
+
+void SimTransport::suspendRead() {
+  read_armed_ = false;
+}
+
+size_t SimTransport::resumeWrite(Buffer&& data, const Peer& peer,
+                                 IOStatus& out_status) noexcept {
+  auto it = end_by_peer_.find(peer.empty() ? server_peer_ : peer);
+  if (it == end_by_peer_.end() && peer.empty() && end_by_peer_.size() == 1) {
+    it = end_by_peer_.begin();
+  }
+  if (it == end_by_peer_.end()) {
+    out_status = peer.empty() ? IOStatus::Error : IOStatus::Fatal;
+    return -1;
+  }
+
+  const auto& target = it->second;
+  const auto n       = data.size();
+  if (!network_->send(*ew_, target.connection, 1 - target.end,
+                      SimNetwork::Message{.data = std::move(data)})) {
+    TTL_LOG(bits::ttl::Trace)
+        << "(write) Peer disconnected, peer=" << it->first;
+    out_status = IOStatus::Eof;
+    return 0;
+  }
+  out_status = IOStatus::Ok;
+  return n;
+}
+
+void SimTransport::suspendWrite(const Peer&) {
+  // Writes never block, nothing is watched
+}
+
+Address SimTransport::addressOf(const Peer& peer) const {
+  const auto it = end_by_peer_.find(peer);
+  return it == end_by_peer_.end() ? Address{} : it->second.address;
+}
+
+}  // namespace getrafty::rpc
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <utility>
+
+#include "event_watcher.hpp"
+#include "transport.hpp"
+
+namespace getrafty::rpc {
+
+class SimTransport;
+
+// In-memory network of simulated transports.
+//
+// A connection is a pair of links, one per direction. Each message takes
+// 'latency' plus up to 'jitter' drawn from the seeded generator, and never
+// overtakes an earlier one on the same link. Deliveries are timers on the
+// sender's EventWatcher, so on a SimEventWatcher a run is deterministic and
+// takes virtual time only. Links are unbounded, writes never block.
+//
+// Not thread-safe: all transports of one network have to be driven by the
+// same thread, e.g. share one SimEventWatcher.
+class SimNetwork : public std::enable_shared_from_this<SimNetwork> {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit SimNetwork(Clock::duration latency = std::chrono::microseconds(100),
+                      Clock::duration jitter  = Clock::duration::zero(),
+                      uint64_t seed           = 0);
+
+  // Non-copyable
+  SimNetwork(const SimNetwork&) = delete;
+
+  SimNetwork& operator=(const SimNetwork&) = delete;
+
+  // Non-movable
+  SimNetwork(SimNetwork&&) = delete;
+
+  SimNetwork& operator=(SimNetwork&&) = delete;
+
+  // Transport that binds to or connects to 'address', "host:port". Port 0
+  // on bind picks a free one.
+  std::unique_ptr<ITransport> transport(const Address& address);
+
+ private:
+  friend class SimTransport;
+
+  struct Message {
+    Buffer data;
+    // Sender closed the connection
+    bool eof{false};
+  };
+
+  struct Link {
+    // Id of the receiving transport, 0 once it left
+    uint64_t to{0};
+    std::deque<Message> in_flight;
+  };
+
+  // links[i] delivers to end i; end 0 connected, end 1 was accepted
+  struct Connection {
+    std::array<Link, 2> links;
+  };
+
+  // Both ends see each other under the same id, connections are never
+  // renumbered
+  static Peer peerOf(uint64_t connection);
+
+  Clock::duration delay();
+
+  // Fills in the port if 0, false if the address is taken or malformed
+  bool listen(uint64_t transport, Address& address);
+  void unlisten(const Address& address);
+  void connect(uint64_t client, const Address& address);
+  // Delivery is timed on 'ew'. False if the receiving end is gone.
+  bool send(io::EventWatcher& ew, uint64_t connection, int to,
+            Message message);
+  // End 'from' is gone, the other end reads eof after what is in flight
+  void leave(io::EventWatcher& ew, uint64_t connection, int from);
+  void deliver(uint64_t connection, int to);
+
+  Clock::duration latency_;
+  Clock::duration jitter_;
+  std::mt19937_64 random_;
+
+  std::unordered_map<uint64_t, SimTransport*> transports_;
+  std::unordered_map<Address, uint64_t> listeners_;
+  std::unordered_map<uint64_t, Connection> connections_;
+  uint64_t next_id_{1};
+  uint16_t next_port_{10000};
+};
+
+// ITransport over a SimNetwork, created by SimNetwork::transport. Reads
+// return whole messages unless 'max_len' is smaller.
+class SimTransport : public ITransport {
+ public:
+  ~SimTransport() override;
+
+  // Non-copyable
+  SimTransport(const SimTransport&) = delete;
+
+  SimTransport& operator=(const SimTransport&) = delete;
+
+  // Lifecycle
+  void attach(io::EventWatcher& ew, Fn<IOEvent&&> replay) override;
+  void bind() override;
+  void connect() override;
+  void close() override;
+
+  // I/O
+  size_t resumeRead(Buffer& out_data, Peer& out_peer, IOStatus& out_status,
+                    size_t offset, size_t max_len) noexcept override;
+  void suspendRead() override;
+
+  size_t resumeWrite(Buffer&& data, const Peer& peer,
+                     IOStatus& out_status) noexcept override;
+  void suspendWrite(const Peer& peer) override;
+
+  [[nodiscard]] Address addressOf(const Peer& peer) const override;
+
+ private:
+  friend class SimNetwork;
+
+  struct Inbound {
+    Peer peer;
+    SimNetwork::Message message;
+    // Bytes of the message already read
+    size_t offset{0};
+  };
+
+  struct End {
+    uint64_t connection;
+    // Which end of it this transport is
+    int end;
+    // Of the other end
+    Address address;
+  };
+
+  SimTransport(std::shared_ptr<SimNetwork> network, uint64_t id,
+               Address address);
+
+  void onConnected(uint64_t connection, int end, const Address& address);
+  void onConnectFailed();
+  void onDelivered(uint64_t connection, SimNetwork::Message message);
+
+  std::shared_ptr<SimNetwork> network_;
+  uint64_t id_;
+  Address address_;
+  bool listening_{false};
+
+  io::EventWatcher* ew_{nullptr};
+  Fn<IOEvent&&> replay_;
+
+  std::unordered_map<Peer, End> end_by_peer_;
+  // Connection made by connect(), writes without a peer go there
+  Peer server_peer_;
+  std::deque<Inbound> inbox_;
+  bool read_armed_{false};
+};
+
+}  // namespace getrafty::rpc
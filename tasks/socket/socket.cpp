@@ -1,4 +1,5 @@
 #include "socket.hpp"
+#include <algorithm>
 #include <array>
 #include <bits/ttl/logger.hpp>
 #include <cassert>
@@ -9,12 +10,23 @@
 
 namespace getrafty::rpc {
 
+namespace {
+constexpr size_t kDefaultWriteLowWatermark  = 256 << 10;  // 256KB
+constexpr size_t kDefaultWriteHighWatermark = 1 << 20;    // 1MB
+// Queued writes handed to the transport at once
+constexpr size_t kMaxWriteBatch = 64;
+}  // namespace
+
 Socket::Socket(io::EventWatcher& ew, std::unique_ptr<ITransport> transport)
-    : state_(Idle), ew_(ew), transport_(std::move(transport)) {
-  // All events are dispatched through single threaded EventWatcher loop
+    : state_(Idle),
+      ew_(ew),
+      transport_(std::move(transport)),
+      write_low_watermark_(kDefaultWriteLowWatermark),
+      write_high_watermark_(kDefaultWriteHighWatermark) {
+  // All events are dispatched through single threaded EventWatcher loop,
+  // transport reports from the loop thread so they are handled right away
   transport_->attach(ew_, [this](IOEvent&& ev) {
-    ew_.runInEventWatcherLoop([self  = shared_from_this(),
-                               event = std::move(ev)]() mutable {
+    ew_.dispatch([self = shared_from_this(), event = std::move(ev)]() mutable {
       std::visit([&](auto&& e) { self->tick(std::forward<decltype(e)>(e)); },
                  std::move(event));
     });
@@ -22,8 +34,9 @@ Socket::Socket(io::EventWatcher& ew, std::unique_ptr<ITransport> transport)
 }
 
 Socket::~Socket() {
+  // Runs inline if the last reference is dropped on the loop thread
   std::latch done{1};
-  ew_.runInEventWatcherLoop([this, &done]() {
+  ew_.dispatch([this, &done]() {
     transport_->close();
     done.count_down();
   });
@@ -160,17 +173,28 @@ void Socket::tick(WriteReq&& ev) {
     return;
   }
 
-  // Try to insert write request into queue (keyed by peer)
-  // If peer already has pending write, reject with WouldBlock
-  const auto& [it, inserted] = write_queue_.emplace(ev.peer, std::move(ev));
-  if (!inserted) {
-    TTL_LOG(bits::ttl::Trace)
-        << "WriteReq rejected: peer busy peer=" << ev.peer;
+  // Queue behind earlier writes to the same peer (keyed by peer), unless
+  // too much is queued for it already
+  auto& queue = write_queue_[ev.peer];
+  if (queue.throttled) {
+    TTL_LOG(bits::ttl::Trace) << "WriteReq rejected: peer over watermark peer="
+                              << ev.peer << " queued=" << queue.bytes;
     ev.callback(IOStatus::WouldBlock);
     return;
   }
 
-  transportWrite(it->second.peer);
+  const bool idle = queue.pending.empty();
+  const Peer peer = ev.peer;
+  queue.bytes += ev.data.size();
+  if (queue.bytes >= write_high_watermark_) {
+    queue.throttled = true;
+  }
+  queue.pending.push_back(std::move(ev));
+
+  // Otherwise the transport is busy and reports WriteReadyRep
+  if (idle) {
+    transportWrite(peer);
+  }
 }
 
 void Socket::tick(CloseReq&& ev) {
@@ -210,9 +234,19 @@ void Socket::tick(CloseReq&& ev) {
     }
   }
 
-  for (auto& [peer, req] : write_queue_) {
-    if (req.callback) {
-      req.callback(IOStatus::Error);
+  // Callbacks may write again, which is rejected now
+  auto write_queue = std::move(write_queue_);
+  write_queue_.clear();
+  for (auto& [peer, queue] : write_queue) {
+    for (auto& held : queue.in_flight) {
+      if (held.callback) {
+        held.callback(IOStatus::Error);
+      }
+    }
+    for (auto& req : queue.pending) {
+      if (req.callback) {
+        req.callback(IOStatus::Error);
+      }
     }
   }
 
@@ -271,6 +305,10 @@ void Socket::transportRead() {
         tick(CloseReq{});
         return;
       }
+      if (status == IOStatus::Eof || status == IOStatus::Fatal) {
+        // Writes to a peer that is gone would never complete
+        failWrites(peer, status);
+      }
       req.callback(status, {}, std::move(peer));
       continue;
     }
@@ -300,61 +338,168 @@ void Socket::transportWrite(const Peer& peer) {
   // Lookup write request based on socket mode:
   // Connected: use empty peer key {} (single peer connection)
   // Bound:     use specific peer (multi-peer server)
-  std::unordered_map<Peer, WriteReq>::iterator it;
-  if ((state_ & Connected) != 0) {
-    it = write_queue_.find({});
-  } else {
-    it = write_queue_.find(peer);
-  }
-
-  if (it == write_queue_.end()) {
+  const auto it =
+      write_queue_.find((state_ & Connected) != 0 ? Peer{} : peer);
+  if (it == write_queue_.end() || it->second.pending.empty()) {
     TTL_LOG(bits::ttl::Trace)
         << "processWrite: peer not in queue peer=" << peer;
     return;
   }
 
-  auto& req                  = it->second;
-  const Peer& queued_peer    = it->first;
-  const Peer& transport_peer = queued_peer;
-  const Peer& log_peer       = queued_peer.empty() ? peer : queued_peer;
-
-  TTL_LOG(bits::ttl::Trace)
-      << "write peer=" << log_peer << " len=" << req.data.size();
-  IOStatus status;
-  auto n = transport_->resumeWrite(std::move(req.data), transport_peer, status);
+  auto& queue               = it->second;
+  const Peer transport_peer = it->first;
+  const Peer& log_peer      = transport_peer.empty() ? peer : transport_peer;
+
+  // Whatever is queued goes to the transport in batches, so small writes
+  // share syscalls
+  std::vector<Fn<IOStatus>> completed;
+  IOStatus status = IOStatus::Ok;
+  while (!queue.pending.empty() && status == IOStatus::Ok) {
+    const auto count = std::min(queue.pending.size(), kMaxWriteBatch);
+    std::array<size_t, kMaxWriteBatch> sizes{};
+    size_t handed = 0;
+    write_batch_.clear();
+    for (size_t i = 0; i < count; ++i) {
+      sizes[i] = queue.pending[i].data.size();
+      handed += sizes[i];
+      write_batch_.push_back(std::move(queue.pending[i].data));
+    }
 
-  auto finalize = [&](IOStatus result) {
-    auto request = std::move(it->second);
-    write_queue_.erase(it);
-    if (request.callback) {
-      request.callback(result);
+    TTL_LOG(bits::ttl::Trace) << "write peer=" << log_peer
+                              << " buffers=" << count << " len=" << handed;
+    size_t held     = 0;
+    const auto done = transport_->resumeWriteBatch(write_batch_,
+                                                   transport_peer, status,
+                                                   held);
+
+    // What did not go out goes back, trimmed if it went out in part
+    size_t left = 0;
+    for (size_t i = done; i < count; ++i) {
+      left += write_batch_[i].size();
+      queue.pending[i].data = std::move(write_batch_[i]);
+    }
+    queue.bytes -= handed - left;
+    for (size_t i = 0; i < done; ++i) {
+      auto req = std::move(queue.pending.front());
+      queue.pending.pop_front();
+      if (i + held < done) {
+        completed.push_back(std::move(req.callback));
+      } else {
+        // Transport holds the data, it still counts against the watermark
+        queue.bytes += sizes[i];
+        queue.in_flight.push_back(
+            {.bytes = sizes[i], .callback = std::move(req.callback)});
+      }
     }
-  };
+    TTL_LOG(bits::ttl::Trace) << "Write successful peer=" << log_peer
+                              << " len=" << handed - left
+                              << " held=" << held;
+  }
 
-  if (n < 0) {
+  std::vector<Fn<IOStatus>> failed;
+  if (status == IOStatus::WouldBlock) {
+    TTL_LOG(bits::ttl::Trace) << "Write would block peer=" << log_peer
+                              << " queued=" << queue.bytes;
+  } else if (status != IOStatus::Ok) {
     TTL_LOG(bits::ttl::Error) << "Write failed peer=" << log_peer
                               << " status=" << static_cast<int>(status);
     // TODO: Handle write to a disconnected peer
-    finalize(status);
-    return;
+    // Connection is gone, so is everything queued for it
+    for (auto& held : queue.in_flight) {
+      failed.push_back(std::move(held.callback));
+    }
+    for (auto& req : queue.pending) {
+      failed.push_back(std::move(req.callback));
+    }
+    queue.in_flight.clear();
+    queue.pending.clear();
+    queue.bytes = 0;
   }
 
-  if (status == IOStatus::WouldBlock) {
-    TTL_LOG(bits::ttl::Trace) << "Write would block peer=" << log_peer;
+  if (queue.bytes <= write_low_watermark_) {
+    queue.throttled = false;
+  }
+  if (queue.pending.empty() && queue.in_flight.empty()) {
+    write_queue_.erase(it);
+  }
+
+  // Callbacks last, they may write again
+  for (auto& callback : completed) {
+    if (callback) {
+      callback(IOStatus::Ok);
+    }
+  }
+  for (auto& callback : failed) {
+    if (callback) {
+      callback(status);
+    }
+  }
+}
+
+void Socket::tick(WriteDoneRep&& ev) {
+  // Called by transport when it no longer holds the data of earlier writes.
+  // Completes them in write order.
+  TTL_LOG(bits::ttl::Trace) << "WriteDoneRep peer=" << ev.peer
+                            << " count=" << ev.count;
+
+  const auto it =
+      write_queue_.find((state_ & Connected) != 0 ? Peer{} : ev.peer);
+  if (it == write_queue_.end()) {
+    // Failed already
     return;
   }
 
-  if (status == IOStatus::Ok) {
-    TTL_LOG(bits::ttl::Trace)
-        << "Write successful peer=" << log_peer << " len=" << n;
-    finalize(IOStatus::Ok);
-  } else {
-    TTL_LOG(bits::ttl::Error) << "Write completed with error peer=" << log_peer
-                              << " status=" << static_cast<int>(status);
-    finalize(status);
+  auto& queue = it->second;
+  std::vector<Fn<IOStatus>> done;
+  for (size_t i = 0; i < ev.count && !queue.in_flight.empty(); ++i) {
+    queue.bytes -= queue.in_flight.front().bytes;
+    done.push_back(std::move(queue.in_flight.front().callback));
+    queue.in_flight.pop_front();
+  }
+  if (queue.bytes <= write_low_watermark_) {
+    queue.throttled = false;
+  }
+  if (queue.pending.empty() && queue.in_flight.empty()) {
+    write_queue_.erase(it);
+  }
+
+  // Callbacks last, they may write again
+  for (auto& callback : done) {
+    if (callback) {
+      callback(ev.status);
+    }
+  }
+}
+
+void Socket::failWrites(const Peer& peer, const IOStatus status) {
+  const auto it = write_queue_.find(peer);
+  if (it == write_queue_.end()) {
+    return;
+  }
+  auto queue = std::move(it->second);
+  write_queue_.erase(it);
+
+  TTL_LOG(bits::ttl::Trace) << "Failing writes peer=" << peer
+                            << " queued=" << queue.bytes;
+  for (auto& held : queue.in_flight) {
+    if (held.callback) {
+      held.callback(status);
+    }
+  }
+  for (auto& req : queue.pending) {
+    if (req.callback) {
+      req.callback(status);
+    }
   }
 }
 
+void Socket::setWriteWatermarks(const size_t low, const size_t high) {
+  ew_.runInEventWatcherLoop([self = shared_from_this(), low, high]() {
+    self->write_low_watermark_  = low;
+    self->write_high_watermark_ = std::max(low, high);
+  });
+}
+
 void Socket::bind(Fn<IOStatus, Address> callback) {
   ew_.runInEventWatcherLoop(
       [self = shared_from_this(), cb = std::move(callback)]() mutable {
@@ -385,6 +530,13 @@ void Socket::write(Buffer data, Peer peer, Fn<IOStatus> callback) {
   });
 }
 
+void Socket::peerAddress(Peer peer, Fn<Address> callback) {
+  ew_.runInEventWatcherLoop(
+      [self = shared_from_this(), peer, cb = std::move(callback)]() mutable {
+        cb(self->transport_->addressOf(peer));
+      });
+}
+
 void Socket::close(Fn<> callback) {
   ew_.runInEventWatcherLoop(
       [self = shared_from_this(), cb = std::move(callback)]() mutable {
@@ -1,10 +1,13 @@
 #pragma once
 
 #include <sys/types.h>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "bits/ring_buffer.hpp"
 #include "event_watcher.hpp"
@@ -64,7 +67,13 @@ class Socket : public std::enable_shared_from_this<Socket> {
   void bind(Fn<IOStatus, Address> callback);
   void connect(Fn<IOStatus> callback);
   void read(Fn<IOStatus, Buffer&&, Peer> callback);
+  // Writes to one peer go out in order. Once more than the high watermark
+  // of bytes is queued for a peer, further writes to it fail with
+  // WouldBlock until its queue drains below the low watermark.
   void write(Buffer data, Peer peer, Fn<IOStatus> callback);
+  void setWriteWatermarks(size_t low, size_t high);
+  // "host:port" of 'peer', empty once the connection is gone
+  void peerAddress(Peer peer, Fn<Address> callback);
 
  private:
   enum SocketState : uint8_t {
@@ -88,10 +97,29 @@ class Socket : public std::enable_shared_from_this<Socket> {
   void tick(ConnectRep&& ev);
   void tick(ReadReadyRep&& ev);
   void tick(WriteReadyRep&& ev);
+  void tick(WriteDoneRep&& ev);
+
+  // Write the transport still holds the data of
+  struct HeldWrite {
+    size_t bytes;
+    Fn<IOStatus> callback;
+  };
+
+  struct WriteQueue {
+    std::deque<WriteReq> pending;
+    // Written, complete with WriteDoneRep
+    std::deque<HeldWrite> in_flight;
+    // Bytes of 'pending' and 'in_flight'
+    size_t bytes{0};
+    // Went over the high watermark, takes no writes until under the low one
+    bool throttled{false};
+  };
 
   // Internal functions called to complete I/O operation
   void transportRead();
   void transportWrite(const Peer& peer);
+  // Fails everything queued for 'peer', its connection is gone
+  void failWrites(const Peer& peer, IOStatus status);
 
   uint8_t state_;
   io::EventWatcher& ew_;
@@ -100,7 +128,11 @@ class Socket : public std::enable_shared_from_this<Socket> {
   bits::RingBuffer<BindReq, 1> bind_queue_;
   bits::RingBuffer<ConnectReq, 1> connect_queue_;
   bits::RingBuffer<ReadReq, 1024> read_queue_;
-  std::unordered_map<Peer, WriteReq> write_queue_;
+  std::unordered_map<Peer, WriteQueue> write_queue_;
+  size_t write_low_watermark_;
+  size_t write_high_watermark_;
+  // Scratch for handing queued buffers to the transport in one batch
+  std::vector<Buffer> write_batch_;
 };
 
 }  // namespace getrafty::rpc
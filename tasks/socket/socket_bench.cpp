@@ -1,4 +1,8 @@
+#include <arpa/inet.h>
 #include <benchmark/benchmark.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <atomic>
 #include <bits/algo.hpp>
@@ -6,14 +10,18 @@
 #include <chrono>
 #include <cmath>
 #include <cstdint>
+#include <functional>
 #include <latch>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "event_watcher.hpp"
 #include "framed_transport.hpp"
+#include "sim_event_watcher.hpp"
+#include "sim_transport.hpp"
 #include "socket.hpp"
 #include "tcp_transport.hpp"
 #include "transport.hpp"
@@ -137,10 +145,9 @@ class EchoClient : public std::enable_shared_from_this<EchoClient> {
   std::shared_ptr<Socket> socket_;
 };
 
-static void BM_SocketPingPong(benchmark::State& state) {
+static void runPingPong(benchmark::State& state, EventWatcher& ew) {
   const auto payload_size = static_cast<size_t>(state.range(0));
 
-  EventWatcher ew;
   auto server = std::make_shared<EchoServer>("127.0.0.1:5678", ew);
   auto client = std::make_shared<EchoClient>("127.0.0.1:5678", ew);
 
@@ -180,6 +187,154 @@ static void BM_SocketPingPong(benchmark::State& state) {
       benchmark::Counter(state.iterations(), benchmark::Counter::kIsRate);
 }
 
+static void BM_SocketPingPong(benchmark::State& state) {
+  EventWatcher ew;
+  runPingPong(state, ew);
+}
+
+// Loop spins instead of sleeping between messages, no scheduler wakeups
+static void BM_SocketPingPongBusyPoll(benchmark::State& state) {
+  EventWatcher ew;
+  ew.setBusyPoll(std::chrono::microseconds(state.range(1)));
+  runPingPong(state, ew);
+}
+
+// Client writes 'bytes' at a time over an unframed TcpTransport while a
+// blocking reader drains the other end; 'zerocopy' sends them with
+// MSG_ZEROCOPY. FramedTransport hands frames down one resumeWrite at a
+// time, which never goes zero-copy, so the ping-pong above cannot take
+// this path. A zero-copy write completes once the kernel is done with its
+// buffer, i.e. once the reader took the data.
+static void BM_SocketStream(benchmark::State& state) {
+  const auto payload_size = static_cast<size_t>(state.range(0));
+  const bool zerocopy     = state.range(1) != 0;
+
+  const int listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  const int on        = 1;
+  ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port        = htons(5679);
+  if (::bind(listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) !=
+          0 ||
+      ::listen(listen_fd, 1) != 0) {
+    ::close(listen_fd);
+    state.SkipWithError("Failed to listen on 127.0.0.1:5679");
+    return;
+  }
+
+  std::thread reader([listen_fd]() {
+    const int fd = ::accept(listen_fd, nullptr, nullptr);
+    std::vector<uint8_t> sink(1 << 20);
+    while (fd >= 0 && ::recv(fd, sink.data(), sink.size(), 0) > 0) {
+    }
+    ::close(fd);
+  });
+
+  EventWatcher ew;
+  auto transport = std::make_unique<TcpTransport>("127.0.0.1:5679");
+  if (zerocopy) {
+    transport->enableZeroCopy();
+  }
+  auto client = std::make_shared<Socket>(ew, std::move(transport));
+  IOStatus status = IOStatus::Fatal;
+  std::latch connected(1);
+  client->connect([&](IOStatus s) {
+    status = s;
+    connected.count_down();
+  });
+  connected.wait();
+
+  const Buffer baseline(payload_size, kPayloadFillByte);
+  for (auto _ : state) {
+    if (status != IOStatus::Ok) {
+      state.SkipWithError("Write failed");
+      break;
+    }
+    // Copy of the payload stays out of the measurement
+    Buffer payload(baseline);
+    std::latch written(1);
+    const auto start = std::chrono::steady_clock::now();
+    client->write(std::move(payload), {}, [&](IOStatus s) {
+      status = s;
+      written.count_down();
+    });
+    written.wait();
+    state.SetIterationTime(std::chrono::duration<double>(
+                               std::chrono::steady_clock::now() - start)
+                               .count());
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * payload_size));
+
+  std::latch closed(1);
+  client->close([&]() { closed.count_down(); });
+  closed.wait();
+  reader.join();
+  ::close(listen_fd);
+}
+
+// 'clients' simulated nodes each send one request per round to a single
+// echo server over an in-memory network; latency counters are virtual time
+static void BM_SimClusterEcho(benchmark::State& state) {
+  const auto clients = static_cast<size_t>(state.range(0));
+
+  SimEventWatcher sim(1);
+  auto network = std::make_shared<SimNetwork>(std::chrono::microseconds(50),
+                                              std::chrono::microseconds(20), 1);
+
+  auto server = std::make_shared<Socket>(sim, network->transport("10.0.0.1:0"));
+  Address address;
+  server->bind([&](IOStatus, Address bound) { address = std::move(bound); });
+  sim.runUntilIdle();
+
+  std::function<void()> serve = [&]() {
+    server->read([&](IOStatus status, Buffer&& data, Peer peer) {
+      if (status != IOStatus::Ok) {
+        return;
+      }
+      server->write(std::move(data), std::move(peer), [](IOStatus) {});
+      serve();
+    });
+  };
+  serve();
+
+  std::vector<std::shared_ptr<Socket>> nodes;
+  for (size_t i = 0; i < clients; ++i) {
+    nodes.push_back(std::make_shared<Socket>(sim, network->transport(address)));
+    nodes.back()->connect([](IOStatus) {});
+  }
+  sim.runUntilIdle();
+
+  const Buffer payload(64, kPayloadFillByte);
+  std::vector<double> samples;
+  samples.reserve(state.max_iterations * clients);
+  for (auto _ : state) {
+    const auto start = sim.now();
+    for (auto& node : nodes) {
+      node->write(Buffer(payload), {}, [](IOStatus) {});
+      node->read([&](IOStatus, Buffer&&, Peer) {
+        samples.push_back(std::chrono::duration<double, std::micro>(
+                              sim.now() - start)
+                              .count());
+      });
+    }
+    sim.runUntilIdle();
+  }
+
+  for (auto& node : nodes) {
+    node->close([]() {});
+  }
+  server->close([]() {});
+  sim.runUntilIdle();
+
+  state.counters["virtual p50(us)"] = bits::Histogram<50, 100>()(samples);
+  state.counters["virtual p99(us)"] = bits::Histogram<99, 100>()(samples);
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * clients));
+}
+
 BENCHMARK(BM_SocketPingPong)
     ->ArgName("bytes")
     ->Arg(64)
@@ -193,6 +348,30 @@ BENCHMARK(BM_SocketPingPong)
     ->Repetitions(10)
     ->ReportAggregatesOnly(true);
 
+BENCHMARK(BM_SocketPingPongBusyPoll)
+    ->ArgNames({"bytes", "spin_us"})
+    ->Args({64, 200})
+    ->Args({4096, 200})
+    ->Args({65536, 200})
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(10000)
+    ->Repetitions(10)
+    ->ReportAggregatesOnly(true);
+
+BENCHMARK(BM_SocketStream)
+    ->ArgNames({"bytes", "zerocopy"})
+    ->ArgsProduct({{4096, 65536, 262144, 524288}, {0, 1}})
+    ->UseManualTime()
+    ->Unit(benchmark::kMicrosecond)
+    ->Iterations(2000);
+
+BENCHMARK(BM_SimClusterEcho)
+    ->ArgName("clients")
+    ->Arg(100)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Unit(benchmark::kMillisecond);
+
 int main(int argc, char** argv) {
   bits::ttl::Ttl::init("discard://");
   benchmark::Initialize(&argc, argv);
@@ -5,18 +5,25 @@
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <array>
 #include <atomic>
 #include <bits/ttl/ttl.hpp>
 #include <chrono>
 #include <cstdint>
+#include <functional>
 #include <future>
 #include <latch>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
 #include <utility>
 #include <vector>
 #include "event_watcher.hpp"
+#include "event_watcher_group.hpp"
 #include "framed_transport.hpp"
+#include "sim_event_watcher.hpp"
+#include "sim_transport.hpp"
 #include "tcp_transport.hpp"
 #include "transport.hpp"
 
@@ -33,6 +40,66 @@ SocketPtr makeSocket(const Address& address,
   return std::make_shared<getrafty::rpc::Socket>(watcher, std::move(transport));
 }
 
+// Unframed, so the peer can be a plain socket
+SocketPtr makeRawSocket(const Address& address,
+                        getrafty::io::EventWatcher& watcher) {
+  return std::make_shared<getrafty::rpc::Socket>(
+      watcher, std::make_unique<TcpTransport>(address));
+}
+
+// Blocking listener on a free loopback port, -1 on failure
+int rawListen(std::string& out_address) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len        = sizeof(addr);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+      ::listen(fd, 16) != 0 ||
+      ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  out_address = "127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+  return fd;
+}
+
+// Blocking client connected to "127.0.0.1:port", -1 on failure
+int rawConnect(const std::string& address) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_in addr{};
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port        = htons(static_cast<uint16_t>(
+      std::stoi(address.substr(address.rfind(':') + 1))));
+  if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Exactly 'size' bytes, fewer if the peer closes first
+Buffer rawRecv(const int fd, const size_t size) {
+  Buffer data(size);
+  size_t received = 0;
+  while (received < size) {
+    const auto n = ::recv(fd, data.data() + received, size - received, 0);
+    if (n <= 0) {
+      break;
+    }
+    received += static_cast<size_t>(n);
+  }
+  data.resize(received);
+  return data;
+}
+
 }  // namespace
 
 using namespace getrafty::io;
@@ -453,6 +520,70 @@ TEST_F(BaseSocketTest, ServerReceivesPeerClosedStatus) {
   server_close.wait();
 }
 
+TEST_F(BaseSocketTest, PeerAddressKnownWhileConnected) {
+  auto server = makeSocket("127.0.0.1:0", *watcher_);
+  std::string bind_addr;
+  std::latch bind_done{1};
+  server->bind([&](IOStatus s, const Address& addr) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    bind_addr = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+
+  auto client = makeSocket(bind_addr, *watcher_);
+  std::latch connect_done{1};
+  client->connect([&](IOStatus s) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    connect_done.count_down();
+  });
+  connect_done.wait();
+
+  Peer peer_id;
+  std::latch peer_known{1};
+  server->read([&](IOStatus s, Buffer&&, const Peer& peer) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    peer_id = peer;
+    peer_known.count_down();
+  });
+  client->write({'h', 'i'}, {}, [](IOStatus) {});
+  peer_known.wait();
+  EXPECT_FALSE(peer_id.empty());
+
+  Address address;
+  std::latch address_known{1};
+  server->peerAddress(peer_id, [&](const Address& a) {
+    address = a;
+    address_known.count_down();
+  });
+  address_known.wait();
+  EXPECT_TRUE(address.starts_with("127.0.0.1:"));
+
+  std::latch eof_seen{1};
+  server->read([&](IOStatus s, Buffer&&, const Peer&) {
+    EXPECT_EQ(s, IOStatus::Eof);
+    eof_seen.count_down();
+  });
+  std::latch client_close{1};
+  client->close([&]() { client_close.count_down(); });
+  client_close.wait();
+  eof_seen.wait();
+
+  // Handle of a closed connection resolves to nothing, even if the fd is
+  // reused
+  std::latch address_gone{1};
+  server->peerAddress(peer_id, [&](const Address& a) {
+    address = a;
+    address_gone.count_down();
+  });
+  address_gone.wait();
+  EXPECT_TRUE(address.empty());
+
+  std::latch server_close{1};
+  server->close([&]() { server_close.count_down(); });
+  server_close.wait();
+}
+
 TEST_F(BaseSocketTest, WriteFailsWhenPeerClosesDuringTransfer) {
   auto server = makeSocket("127.0.0.1:0", *watcher_);
   std::string bind_addr;
@@ -472,7 +603,7 @@ TEST_F(BaseSocketTest, WriteFailsWhenPeerClosesDuringTransfer) {
   });
   connect_done.wait();
 
-  std::string peer_id;
+  Peer peer_id;
   std::latch peer_known{1};
   server->read([&](IOStatus s, Buffer&&, const Peer& peer) {
     ASSERT_EQ(s, IOStatus::Ok);
@@ -880,6 +1011,71 @@ TEST_F(BaseSocketTest, WriteToClosedSocket) {
   close_done.wait();
 }
 
+TEST_F(BaseSocketTest, DataArrivedBeforeReadIsDelivered) {
+  auto server = makeSocket("127.0.0.1:0", *watcher_);
+  std::string bind_addr;
+  std::latch bind_done{1};
+  server->bind([&](IOStatus s, const Address& addr) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    bind_addr = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+
+  // Only some connections turn ready, the rest stay idle
+  constexpr size_t kClients = 8;
+  constexpr size_t kWriters = 3;
+  std::vector<SocketPtr> clients;
+  for (size_t i = 0; i < kClients; ++i) {
+    auto client = makeSocket(bind_addr, *watcher_);
+    std::latch connect_done{1};
+    client->connect([&](IOStatus s) {
+      ASSERT_EQ(s, IOStatus::Ok);
+      connect_done.count_down();
+    });
+    connect_done.wait();
+    clients.push_back(std::move(client));
+  }
+
+  std::latch written{kWriters};
+  for (size_t i = 0; i < kWriters; ++i) {
+    clients[i]->write({static_cast<uint8_t>('a' + i)}, {}, [&](IOStatus s) {
+      EXPECT_EQ(s, IOStatus::Ok);
+      written.count_down();
+    });
+  }
+  written.wait();
+  // Readiness reported while no read is pending is not lost
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  std::mutex mutex;
+  std::set<uint8_t> received;
+  std::set<Peer> peers;
+  std::latch read_done{kWriters};
+  for (size_t i = 0; i < kWriters; ++i) {
+    server->read([&](IOStatus s, Buffer&& data, const Peer& peer) {
+      EXPECT_EQ(s, IOStatus::Ok);
+      EXPECT_EQ(data.size(), 1U);
+      std::lock_guard lock(mutex);
+      received.insert(data.empty() ? 0 : data[0]);
+      peers.insert(peer);
+      read_done.count_down();
+    });
+  }
+  read_done.wait();
+  EXPECT_EQ(received, (std::set<uint8_t>{'a', 'b', 'c'}));
+  EXPECT_EQ(peers.size(), kWriters);
+
+  for (auto& client : clients) {
+    std::latch close_done{1};
+    client->close([&]() { close_done.count_down(); });
+    close_done.wait();
+  }
+  std::latch server_close{1};
+  server->close([&]() { server_close.count_down(); });
+  server_close.wait();
+}
+
 TEST_F(BaseSocketTest, DoubleClose) {
   auto server      = makeSocket("127.0.0.1:0", *watcher_);
   auto bind_status = IOStatus::Fatal;
@@ -1429,6 +1625,921 @@ TEST_F(BaseSocketTest, MultiThread) {
   }
 }
 
+TEST_F(BaseSocketTest, ServerAndClientOnDifferentLoops) {
+  EventWatcherGroup group(2);
+  auto server_lease = group.acquire();
+  auto client_lease = group.acquire();
+  ASSERT_NE(server_lease.index(), client_lease.index());
+
+  auto server      = makeSocket("127.0.0.1:0", server_lease.watcher());
+  auto bind_status = IOStatus::Fatal;
+  std::string bind_addr;
+  std::latch bind_done(1);
+  server->bind([&](IOStatus s, const Address& addr) {
+    bind_status = s;
+    bind_addr   = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+  ASSERT_EQ(bind_status, IOStatus::Ok);
+
+  auto client         = makeSocket(bind_addr, client_lease.watcher());
+  auto connect_status = IOStatus::Fatal;
+  std::latch connect_done(1);
+  client->connect([&](IOStatus s) {
+    connect_status = s;
+    connect_done.count_down();
+  });
+  connect_done.wait();
+  ASSERT_EQ(connect_status, IOStatus::Ok);
+
+  std::latch read_done(1);
+  IOStatus read_status = IOStatus::Fatal;
+  Buffer received;
+  server->read([&](IOStatus s, Buffer&& data, const Peer&) {
+    read_status = s;
+    received    = std::move(data);
+    read_done.count_down();
+  });
+
+  std::latch write_done{1};
+  client->write({'h', 'e', 'l', 'l', 'o'}, {},
+                [&](IOStatus) { write_done.count_down(); });
+  write_done.wait();
+
+  read_done.wait();
+  ASSERT_EQ(read_status, IOStatus::Ok);
+  ASSERT_EQ(std::string(received.begin(), received.end()), "hello");
+
+  {
+    std::latch close_done{1};
+    client->close([&close_done]() { close_done.count_down(); });
+    close_done.wait();
+  }
+  {
+    std::latch close_done{1};
+    server->close([&close_done]() { close_done.count_down(); });
+    close_done.wait();
+  }
+}
+
+TEST_F(BaseSocketTest, ReusePortListenersSpreadAcrossLoops) {
+  constexpr size_t kLoops   = 2;
+  constexpr size_t kClients = 32;
+  EventWatcherGroup group(kLoops);
+
+  // One listener per loop on the same port, the kernel hands each incoming
+  // connection to one of them
+  std::vector<SocketPtr> servers;
+  Address address = "127.0.0.1:0";
+  for (size_t i = 0; i < kLoops; ++i) {
+    auto server = makeRawSocket(address, group.at(i));
+    std::promise<Address> bound;
+    server->bind([&](IOStatus s, const Address& endpoint) {
+      bound.set_value(s == IOStatus::Ok ? endpoint : Address{});
+    });
+    address = bound.get_future().get();
+    ASSERT_FALSE(address.empty());
+    servers.push_back(std::move(server));
+  }
+
+  std::array<std::atomic<size_t>, kLoops> received{};
+  std::atomic<bool> off_loop{false};
+  std::atomic<bool> stopping{false};
+  std::function<void(size_t)> arm = [&](const size_t i) {
+    servers[i]->read([&, i](IOStatus s, Buffer&& data, Peer) {
+      if (!group.at(i).isInLoopThread()) {
+        off_loop.store(true);
+      }
+      if (s == IOStatus::Ok) {
+        received[i].fetch_add(data.size());
+      }
+      if (!stopping.load()) {
+        arm(i);
+      }
+    });
+  };
+  for (size_t i = 0; i < kLoops; ++i) {
+    arm(i);
+  }
+
+  std::vector<int> clients;
+  for (size_t i = 0; i < kClients; ++i) {
+    const int fd = rawConnect(address);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::send(fd, "x", 1, 0), 1);
+    clients.push_back(fd);
+  }
+
+  const auto total = [&]() {
+    size_t sum = 0;
+    for (const auto& count : received) {
+      sum += count.load();
+    }
+    return sum;
+  };
+  for (int i = 0; i < 500 && total() < kClients; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(total(), kClients);
+  // All on one loop has odds of 2^-31
+  for (size_t i = 0; i < kLoops; ++i) {
+    EXPECT_GT(received[i].load(), 0U) << "loop " << i;
+  }
+  EXPECT_FALSE(off_loop.load());
+
+  stopping.store(true);
+  for (auto& server : servers) {
+    std::latch close_done{1};
+    server->close([&]() { close_done.count_down(); });
+    close_done.wait();
+  }
+  for (const int fd : clients) {
+    ::close(fd);
+  }
+}
+
+TEST_F(BaseSocketTest, WritesToOnePeerArePipelined) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  auto client = makeRawSocket(address, *watcher_);
+  std::latch connect_done{1};
+  client->connect([&](IOStatus s) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    connect_done.count_down();
+  });
+  connect_done.wait();
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  // Posted back to back, none waits for the one before
+  constexpr size_t kWrites = 1000;
+  std::atomic<size_t> ok{0};
+  std::latch written{kWrites};
+  for (size_t i = 0; i < kWrites; ++i) {
+    client->write({static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8)}, {},
+                  [&](IOStatus s) {
+                    if (s == IOStatus::Ok) {
+                      ok.fetch_add(1);
+                    }
+                    written.count_down();
+                  });
+  }
+  written.wait();
+  EXPECT_EQ(ok.load(), kWrites);
+
+  const auto received = rawRecv(server_fd, 2 * kWrites);
+  ASSERT_EQ(received.size(), 2 * kWrites);
+  for (size_t i = 0; i < kWrites; ++i) {
+    ASSERT_EQ(received[2 * i] | (received[2 * i + 1] << 8), i & 0xffff);
+  }
+
+  std::latch close_done{1};
+  client->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, WritesOverHighWatermarkWouldBlock) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  auto client = makeRawSocket(address, *watcher_);
+  client->setWriteWatermarks(64UL << 10, 256UL << 10);
+  std::latch connect_done{1};
+  client->connect([&](IOStatus s) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    connect_done.count_down();
+  });
+  connect_done.wait();
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  // More than socket buffers hold while nobody reads
+  constexpr size_t kLarge = 32UL << 20;
+  std::promise<IOStatus> large_done;
+  std::promise<IOStatus> small_done;
+  client->write(Buffer(kLarge, 0x42), {},
+                [&](IOStatus s) { large_done.set_value(s); });
+  client->write({'x'}, {}, [&](IOStatus s) { small_done.set_value(s); });
+  EXPECT_EQ(small_done.get_future().get(), IOStatus::WouldBlock);
+
+  EXPECT_EQ(rawRecv(server_fd, kLarge).size(), kLarge);
+  auto large_status = large_done.get_future();
+  ASSERT_EQ(large_status.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(large_status.get(), IOStatus::Ok);
+
+  // Drained, takes writes again
+  std::promise<IOStatus> again_done;
+  client->write({'y'}, {}, [&](IOStatus s) { again_done.set_value(s); });
+  EXPECT_EQ(again_done.get_future().get(), IOStatus::Ok);
+  EXPECT_EQ(rawRecv(server_fd, 1), Buffer{'y'});
+
+  std::latch close_done{1};
+  client->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, PeerEofFailsItsStuckWrites) {
+  auto server = makeRawSocket("127.0.0.1:0", *watcher_);
+  std::string bind_addr;
+  std::latch bind_done{1};
+  server->bind([&](IOStatus s, const Address& addr) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    bind_addr = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+
+  const int client_fd = rawConnect(bind_addr);
+  ASSERT_GE(client_fd, 0);
+  ASSERT_EQ(::send(client_fd, "h", 1, 0), 1);
+  std::promise<Peer> hello;
+  server->read([&](IOStatus s, Buffer&&, const Peer& peer) {
+    EXPECT_EQ(s, IOStatus::Ok);
+    hello.set_value(peer);
+  });
+  const auto peer = hello.get_future().get();
+  ASSERT_FALSE(peer.empty());
+
+  // More than socket buffers hold while the client does not read
+  std::promise<IOStatus> write_done;
+  server->write(Buffer(32UL << 20, 0x42), peer,
+                [&](IOStatus s) { write_done.set_value(s); });
+  auto write_status = write_done.get_future();
+  ASSERT_EQ(write_status.wait_for(std::chrono::milliseconds(50)),
+            std::future_status::timeout);
+
+  std::promise<std::pair<IOStatus, Peer>> eof;
+  server->read([&](IOStatus s, Buffer&&, const Peer& from) {
+    eof.set_value({s, from});
+  });
+  ASSERT_EQ(::shutdown(client_fd, SHUT_WR), 0);
+
+  const auto [status, from] = eof.get_future().get();
+  EXPECT_EQ(status, IOStatus::Eof);
+  EXPECT_EQ(from, peer);
+  ASSERT_EQ(write_status.wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(write_status.get(), IOStatus::Eof);
+
+  std::latch close_done{1};
+  server->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(client_fd);
+}
+
+TEST_F(BaseSocketTest, DrainedWriteWatchLetsLoopSleep) {
+  auto server = makeRawSocket("127.0.0.1:0", *watcher_);
+  std::string bind_addr;
+  std::latch bind_done{1};
+  server->bind([&](IOStatus s, const Address& addr) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    bind_addr = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+
+  const int client_fd = rawConnect(bind_addr);
+  ASSERT_GE(client_fd, 0);
+  ASSERT_EQ(::send(client_fd, "h", 1, 0), 1);
+  std::promise<Peer> hello;
+  server->read([&](IOStatus s, Buffer&&, const Peer& peer) {
+    EXPECT_EQ(s, IOStatus::Ok);
+    hello.set_value(peer);
+  });
+  const auto peer = hello.get_future().get();
+  ASSERT_FALSE(peer.empty());
+
+  // Stuck until the client reads, which arms the write watch
+  constexpr size_t kSize = 8UL << 20;
+  std::promise<IOStatus> write_done;
+  server->write(Buffer(kSize, 0x42), peer,
+                [&](IOStatus s) { write_done.set_value(s); });
+  auto write_status = write_done.get_future();
+  ASSERT_EQ(write_status.wait_for(std::chrono::milliseconds(50)),
+            std::future_status::timeout);
+  ASSERT_EQ(rawRecv(client_fd, kSize).size(), kSize);
+  ASSERT_EQ(write_status.get(), IOStatus::Ok);
+
+  // Writable fd with nothing queued must not wake the loop
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  const auto before = watcher_->stats().iterations;
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  EXPECT_LT(watcher_->stats().iterations - before, 10U);
+
+  std::latch close_done{1};
+  server->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(client_fd);
+}
+
+TEST_F(BaseSocketTest, TcpTransportGathersAndScatters) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  TcpTransport transport(address);
+  std::promise<IOStatus> connected;
+  std::atomic<bool> readable{false};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.attach(*watcher_, [&](IOEvent&& event) {
+      if (const auto* rep = std::get_if<ConnectRep>(&event)) {
+        connected.set_value(rep->status);
+      } else if (std::holds_alternative<ReadReadyRep>(event)) {
+        readable.store(true);
+      }
+    });
+    transport.connect();
+  });
+  ASSERT_EQ(connected.get_future().get(), IOStatus::Ok);
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  // Header and payload leave together, nothing joins them first
+  uint8_t header[]  = {0, 0, 0, 5};
+  uint8_t payload[] = {'h', 'e', 'l', 'l', 'o'};
+  std::promise<size_t> written;
+  watcher_->runInEventWatcherLoop([&]() {
+    const iovec parts[] = {{.iov_base = header, .iov_len = sizeof(header)},
+                           {.iov_base = payload, .iov_len = sizeof(payload)}};
+    IOStatus status;
+    const auto n = transport.resumeWritev(parts, {}, status);
+    written.set_value(status == IOStatus::Ok ? n : 0);
+  });
+  EXPECT_EQ(written.get_future().get(), 9U);
+  EXPECT_EQ(rawRecv(server_fd, 9),
+            (Buffer{0, 0, 0, 5, 'h', 'e', 'l', 'l', 'o'}));
+
+  ASSERT_EQ(::send(server_fd, "abcdef", 6, 0), 6);
+  for (int i = 0; i < 500 && !readable.load(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(readable.load());
+
+  std::promise<std::string> scattered;
+  watcher_->runInEventWatcherLoop([&]() {
+    uint8_t head[2];
+    uint8_t tail[4];
+    const iovec parts[] = {{.iov_base = head, .iov_len = sizeof(head)},
+                           {.iov_base = tail, .iov_len = sizeof(tail)}};
+    Peer peer;
+    IOStatus status;
+    const auto n = transport.resumeReadv(parts, peer, status);
+    if (status != IOStatus::Ok || n != sizeof(head) + sizeof(tail)) {
+      scattered.set_value({});
+      return;
+    }
+    scattered.set_value(std::string(head, head + sizeof(head)) + "|" +
+                        std::string(tail, tail + sizeof(tail)));
+  });
+  EXPECT_EQ(scattered.get_future().get(), "ab|cdef");
+
+  std::latch closed{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.close();
+    closed.count_down();
+  });
+  closed.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, TcpTransportEmptyScatterGatherIsNoOp) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  TcpTransport transport(address);
+  std::promise<IOStatus> connected;
+  std::atomic<bool> readable{false};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.attach(*watcher_, [&](IOEvent&& event) {
+      if (const auto* rep = std::get_if<ConnectRep>(&event)) {
+        connected.set_value(rep->status);
+      } else if (std::holds_alternative<ReadReadyRep>(event)) {
+        readable.store(true);
+      }
+    });
+    transport.connect();
+  });
+  ASSERT_EQ(connected.get_future().get(), IOStatus::Ok);
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  ASSERT_EQ(::send(server_fd, "ok", 2, 0), 2);
+  for (int i = 0; i < 500 && !readable.load(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(readable.load());
+
+  // Zero-length calls must neither read as EOF nor close the connection
+  std::promise<std::string> result;
+  watcher_->runInEventWatcherLoop([&]() {
+    uint8_t byte = 0;
+    const iovec empty[] = {{.iov_base = &byte, .iov_len = 0},
+                           {.iov_base = &byte, .iov_len = 0}};
+    std::string out;
+    Peer peer;
+    IOStatus status;
+    for (const auto parts :
+         {std::span<const iovec>{}, std::span<const iovec>(empty)}) {
+      out += std::to_string(transport.resumeWritev(parts, {}, status));
+      out += status == IOStatus::Ok ? "ok " : "? ";
+      out += std::to_string(transport.resumeReadv(parts, peer, status));
+      out += status == IOStatus::Error ? "error " : "? ";
+    }
+    Buffer data;
+    transport.resumeRead(data, peer, status, 0, 0);
+    out += std::string(data.begin(), data.end());
+    result.set_value(out);
+  });
+  EXPECT_EQ(result.get_future().get(), "0ok 0error 0ok 0error ok");
+
+  std::latch closed{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.close();
+    closed.count_down();
+  });
+  closed.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, DefaultScatterReadWithoutRoomLosesNothing) {
+  SimEventWatcher sim(7);
+  auto network = std::make_shared<SimNetwork>();
+
+  auto server = std::make_shared<Socket>(sim, network->transport("10.0.0.1:0"));
+  Address address;
+  server->bind([&](IOStatus, Address bound) { address = std::move(bound); });
+  sim.runUntilIdle();
+  server->read([&](IOStatus status, Buffer&& data, Peer peer) {
+    ASSERT_EQ(status, IOStatus::Ok);
+    server->write(std::move(data), std::move(peer), [](IOStatus) {});
+  });
+
+  // SimTransport keeps the default resumeReadv
+  auto client   = network->transport(address);
+  bool readable = false;
+  client->attach(sim, [&](IOEvent&& event) {
+    readable = readable || std::holds_alternative<ReadReadyRep>(event);
+  });
+  client->connect();
+  sim.runUntilIdle();
+  IOStatus status;
+  client->resumeWrite({'a', 'b', 'c'}, {}, status);
+  ASSERT_EQ(status, IOStatus::Ok);
+  Buffer data;
+  Peer peer;
+  client->resumeRead(data, peer, status, 0, 0);
+  ASSERT_EQ(status, IOStatus::WouldBlock);
+  sim.runUntilIdle();
+  ASSERT_TRUE(readable);
+
+  EXPECT_EQ(client->resumeReadv({}, peer, status), 0U);
+  EXPECT_EQ(status, IOStatus::Error);
+  client->resumeRead(data, peer, status, 0, 0);
+  EXPECT_EQ(status, IOStatus::Ok);
+  EXPECT_EQ(data, (Buffer{'a', 'b', 'c'}));
+
+  client->close();
+  server->close([]() {});
+  sim.runUntilIdle();
+}
+
+TEST_F(BaseSocketTest, DefaultWriteBatchResendsShortWrites) {
+  // Writes at most two bytes at a time until 'budget' runs out
+  class ShortTransport : public ITransport {
+   public:
+    void attach(EventWatcher&, Fn<IOEvent&&>) override {}
+    void bind() override {}
+    void connect() override {}
+    void close() override {}
+    size_t resumeRead(Buffer&, Peer&, IOStatus& out_status, size_t,
+                      size_t) noexcept override {
+      out_status = IOStatus::WouldBlock;
+      return 0;
+    }
+    void suspendRead() override {}
+    size_t resumeWrite(Buffer&& data, const Peer&,
+                       IOStatus& out_status) noexcept override {
+      const auto n = std::min<size_t>({data.size(), 2, budget});
+      if (n == 0) {
+        out_status = IOStatus::WouldBlock;
+        return 0;
+      }
+      budget -= n;
+      sent.insert(sent.end(), data.begin(),
+                  data.begin() + static_cast<ptrdiff_t>(n));
+      out_status = IOStatus::Ok;
+      return n;
+    }
+    void suspendWrite(const Peer&) override {}
+    [[nodiscard]] Address addressOf(const Peer&) const override { return {}; }
+
+    size_t budget = 0;
+    Buffer sent;
+  };
+
+  ShortTransport transport;
+  transport.budget = 6;
+  Buffer batch[]   = {{'a', 'b', 'c'}, {'d', 'e', 'f', 'g'}, {'h'}};
+  IOStatus status;
+  size_t held = 0;
+  EXPECT_EQ(transport.resumeWriteBatch(batch, {}, status, held), 1U);
+  EXPECT_EQ(status, IOStatus::WouldBlock);
+  EXPECT_EQ(held, 0U);
+  EXPECT_EQ(transport.sent, (Buffer{'a', 'b', 'c', 'd', 'e', 'f'}));
+  EXPECT_EQ(batch[1], (Buffer{'g'}));
+
+  transport.budget = 8;
+  EXPECT_EQ(
+      transport.resumeWriteBatch(std::span(batch).subspan(1), {}, status, held),
+      2U);
+  EXPECT_EQ(status, IOStatus::Ok);
+  EXPECT_EQ(transport.sent,
+            (Buffer{'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'}));
+}
+
+TEST_F(BaseSocketTest, TcpTransportReadTrimsToBytesRead) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  TcpTransport transport(address);
+  std::promise<IOStatus> connected;
+  std::atomic<bool> readable{false};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.attach(*watcher_, [&](IOEvent&& event) {
+      if (const auto* rep = std::get_if<ConnectRep>(&event)) {
+        connected.set_value(rep->status);
+      } else if (std::holds_alternative<ReadReadyRep>(event)) {
+        readable.store(true);
+      }
+    });
+    transport.connect();
+  });
+  ASSERT_EQ(connected.get_future().get(), IOStatus::Ok);
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  ASSERT_EQ(::send(server_fd, "xyz", 3, 0), 3);
+  for (int i = 0; i < 500 && !readable.load(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  ASSERT_TRUE(readable.load());
+
+  // Read window is larger than the data, what is left of it is cut off
+  std::promise<Buffer> read;
+  watcher_->runInEventWatcherLoop([&]() {
+    Buffer data{'>', '>'};
+    Peer peer;
+    IOStatus status;
+    const auto n = transport.resumeRead(data, peer, status, 2, 64);
+    read.set_value(status == IOStatus::Ok && n == 3 ? data : Buffer{});
+  });
+  EXPECT_EQ(read.get_future().get(), (Buffer{'>', '>', 'x', 'y', 'z'}));
+
+  std::latch closed{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.close();
+    closed.count_down();
+  });
+  closed.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, TcpTransportQuietWhileReadSuspended) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  TcpTransport transport(address);
+  std::promise<IOStatus> connected;
+  std::atomic<int> readable{0};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.attach(*watcher_, [&](IOEvent&& event) {
+      if (const auto* rep = std::get_if<ConnectRep>(&event)) {
+        connected.set_value(rep->status);
+      } else if (std::holds_alternative<ReadReadyRep>(event)) {
+        readable.fetch_add(1);
+      }
+    });
+    transport.connect();
+  });
+  ASSERT_EQ(connected.get_future().get(), IOStatus::Ok);
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  std::latch suspended{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.suspendRead();
+    suspended.count_down();
+  });
+  suspended.wait();
+
+  // Nobody reads, the data waits unreported
+  ASSERT_EQ(::send(server_fd, "a", 1, 0), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(readable.load(), 0);
+
+  std::promise<std::string> drained;
+  watcher_->runInEventWatcherLoop([&]() {
+    Buffer data;
+    Peer peer;
+    IOStatus status;
+    transport.resumeRead(data, peer, status, 0, 0);
+    std::string read(data.begin(), data.end());
+    transport.resumeRead(data, peer, status, 0, 0);
+    drained.set_value(status == IOStatus::WouldBlock ? read : "");
+  });
+  EXPECT_EQ(drained.get_future().get(), "a");
+
+  // Reader ran dry, the next edge is reported again
+  ASSERT_EQ(::send(server_fd, "b", 1, 0), 1);
+  for (int i = 0; i < 500 && readable.load() == 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(readable.load(), 1);
+
+  std::latch closed{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.close();
+    closed.count_down();
+  });
+  closed.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, ZeroCopyWritesCompleteInOrder) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  auto transport = std::make_unique<TcpTransport>(address);
+  transport->enableZeroCopy(4UL << 10);
+  auto client = std::make_shared<Socket>(*watcher_, std::move(transport));
+  std::latch connect_done{1};
+  client->connect([&](IOStatus s) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    connect_done.count_down();
+  });
+  connect_done.wait();
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  // Large writes wait for the kernel, small ones are copied; completions
+  // still come in write order
+  constexpr size_t kWrites = 16;
+  constexpr size_t kLarge  = 64UL << 10;
+  std::mutex mutex;
+  std::vector<size_t> order;
+  std::atomic<size_t> ok{0};
+  std::latch written{kWrites};
+  size_t total = 0;
+  for (size_t i = 0; i < kWrites; ++i) {
+    const auto size = i % 4 == 3 ? 16 : kLarge;
+    total += size;
+    client->write(Buffer(size, static_cast<uint8_t>(i)), {},
+                  [&, i](IOStatus s) {
+                    if (s == IOStatus::Ok) {
+                      ok.fetch_add(1);
+                    }
+                    {
+                      std::lock_guard lock(mutex);
+                      order.push_back(i);
+                    }
+                    written.count_down();
+                  });
+  }
+
+  // Pages leave the socket only once the receiver takes them
+  const auto received = rawRecv(server_fd, total);
+  written.wait();
+  EXPECT_EQ(ok.load(), kWrites);
+  for (size_t i = 0; i < kWrites; ++i) {
+    EXPECT_EQ(order[i], i);
+  }
+  ASSERT_EQ(received.size(), total);
+  size_t offset = 0;
+  for (size_t i = 0; i < kWrites; ++i) {
+    const auto size = i % 4 == 3 ? 16 : kLarge;
+    ASSERT_EQ(received[offset], static_cast<uint8_t>(i));
+    ASSERT_EQ(received[offset + size - 1], static_cast<uint8_t>(i));
+    offset += size;
+  }
+
+  std::latch close_done{1};
+  client->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, ZeroCopyCompletionsAreNotReads) {
+  std::string address;
+  const int listen_fd = rawListen(address);
+  ASSERT_GE(listen_fd, 0);
+
+  TcpTransport transport(address);
+  transport.enableZeroCopy(4UL << 10);
+  std::promise<IOStatus> connected;
+  std::atomic<int> readable{0};
+  std::atomic<size_t> done{0};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.attach(*watcher_, [&](IOEvent&& event) {
+      if (const auto* rep = std::get_if<ConnectRep>(&event)) {
+        connected.set_value(rep->status);
+      } else if (std::holds_alternative<ReadReadyRep>(event)) {
+        readable.fetch_add(1);
+      } else if (const auto* rep = std::get_if<WriteDoneRep>(&event)) {
+        done.fetch_add(rep->count);
+      }
+    });
+    transport.connect();
+  });
+  ASSERT_EQ(connected.get_future().get(), IOStatus::Ok);
+  const int server_fd = ::accept(listen_fd, nullptr, nullptr);
+  ASSERT_GE(server_fd, 0);
+
+  constexpr size_t kLarge = 64UL << 10;
+  const auto write = [&](bool batched, size_t size) {
+    std::promise<size_t> held;
+    watcher_->runInEventWatcherLoop([&]() {
+      Buffer batch[] = {Buffer(size, 'z')};
+      IOStatus status;
+      size_t out_held = 0;
+      if (batched) {
+        transport.resumeWriteBatch(batch, {}, status, out_held);
+      } else {
+        transport.resumeWrite(std::move(batch[0]), {}, status);
+      }
+      held.set_value(status == IOStatus::Ok ? out_held : kLarge);
+    });
+    return held.get_future().get();
+  };
+
+  // Held until the kernel is done, which raises EPOLLERR but is no read
+  ASSERT_EQ(write(true, kLarge), 1U);
+  ASSERT_EQ(rawRecv(server_fd, kLarge).size(), kLarge);
+  for (int i = 0; i < 500 && done.load() == 0; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(done.load(), 1U);
+  EXPECT_EQ(readable.load(), 0);
+
+  // Single writes are done on return, a copied write after one is not held
+  // for a completion
+  ASSERT_EQ(write(false, kLarge), 0U);
+  EXPECT_EQ(write(true, 16), 0U);
+  ASSERT_EQ(rawRecv(server_fd, kLarge + 16).size(), kLarge + 16);
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(done.load(), 1U);
+
+  // Closing while the kernel holds a send resets the connection instead of
+  // leaving the buffer to it
+  ASSERT_EQ(write(true, kLarge), 1U);
+  std::latch closed{1};
+  watcher_->runInEventWatcherLoop([&]() {
+    transport.close();
+    closed.count_down();
+  });
+  closed.wait();
+  char sink[4096];
+  ssize_t n = 0;
+  while ((n = ::recv(server_fd, sink, sizeof(sink), 0)) > 0) {
+  }
+  EXPECT_EQ(n, -1);
+  EXPECT_EQ(errno, ECONNRESET);
+
+  ::close(server_fd);
+  ::close(listen_fd);
+}
+
+TEST_F(BaseSocketTest, ZeroCopyHeldWritesFailWhenPeerLeaves) {
+  auto transport = std::make_unique<TcpTransport>("127.0.0.1:0");
+  transport->enableZeroCopy(4UL << 10);
+  auto server = std::make_shared<Socket>(*watcher_, std::move(transport));
+  std::string bind_addr;
+  std::latch bind_done{1};
+  server->bind([&](IOStatus s, const Address& addr) {
+    ASSERT_EQ(s, IOStatus::Ok);
+    bind_addr = std::string(addr);
+    bind_done.count_down();
+  });
+  bind_done.wait();
+
+  const int client_fd = rawConnect(bind_addr);
+  ASSERT_GE(client_fd, 0);
+  ASSERT_EQ(::send(client_fd, "h", 1, 0), 1);
+  std::promise<Peer> hello;
+  server->read([&](IOStatus s, Buffer&&, const Peer& peer) {
+    EXPECT_EQ(s, IOStatus::Ok);
+    hello.set_value(peer);
+  });
+  const auto peer = hello.get_future().get();
+
+  // More than the socket buffers hold while the client does not read: sends
+  // stuck behind its full window stay held by the kernel
+  constexpr size_t kWrites = 512;
+  std::atomic<size_t> eofs{0};
+  std::atomic<size_t> finished{0};
+  for (size_t i = 0; i < kWrites; ++i) {
+    server->write(Buffer(64UL << 10, 0x42), peer, [&](IOStatus s) {
+      if (s == IOStatus::Eof) {
+        eofs.fetch_add(1);
+      }
+      finished.fetch_add(1);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_LT(finished.load(), kWrites);
+
+  std::promise<IOStatus> eof;
+  server->read(
+      [&](IOStatus s, Buffer&&, const Peer&) { eof.set_value(s); });
+  ASSERT_EQ(::shutdown(client_fd, SHUT_WR), 0);
+  EXPECT_EQ(eof.get_future().get(), IOStatus::Eof);
+  for (int i = 0; i < 500 && finished.load() < kWrites; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(finished.load(), kWrites);
+  EXPECT_GT(eofs.load(), 0U);
+
+  std::latch close_done{1};
+  server->close([&]() { close_done.count_down(); });
+  close_done.wait();
+  ::close(client_fd);
+}
+
+TEST_F(BaseSocketTest, SimulatedClusterEchoesInVirtualTime) {
+  constexpr int kClients = 200;
+  constexpr auto kLatency = std::chrono::milliseconds(1);
+
+  // Declared first, sockets are closed while it is still around
+  SimEventWatcher sim(42);
+  auto network = std::make_shared<SimNetwork>(kLatency);
+
+  auto server = std::make_shared<Socket>(sim, network->transport("10.0.0.1:0"));
+  Address address;
+  server->bind([&](IOStatus status, Address bound) {
+    ASSERT_EQ(status, IOStatus::Ok);
+    address = std::move(bound);
+  });
+  sim.runUntilIdle();
+  ASSERT_FALSE(address.empty());
+
+  // Server echoes whatever it reads and keeps reading
+  std::function<void()> serve = [&]() {
+    server->read([&](IOStatus status, Buffer&& data, Peer peer) {
+      if (status != IOStatus::Ok) {
+        return;
+      }
+      server->write(std::move(data), std::move(peer), [](IOStatus) {});
+      serve();
+    });
+  };
+  serve();
+
+  int echoed = 0;
+  std::vector<SocketPtr> clients;
+  for (int i = 0; i < kClients; ++i) {
+    auto client = std::make_shared<Socket>(sim, network->transport(address));
+    client->connect([&, client, i](IOStatus status) {
+      ASSERT_EQ(status, IOStatus::Ok);
+      const auto text = std::to_string(i);
+      client->write(Buffer(text.begin(), text.end()), {}, [](IOStatus) {});
+      client->read([&, text](IOStatus status, Buffer&& data, Peer) {
+        EXPECT_EQ(status, IOStatus::Ok);
+        EXPECT_EQ(std::string(data.begin(), data.end()), text);
+        ++echoed;
+      });
+    });
+    clients.push_back(std::move(client));
+  }
+
+  EXPECT_TRUE(sim.runUntilIdle());
+  EXPECT_EQ(echoed, kClients);
+  // Handshake round trip, then request and reply
+  EXPECT_EQ(sim.now().time_since_epoch(), 4 * kLatency);
+
+  for (auto& client : clients) {
+    client->close([]() {});
+  }
+  server->close([]() {});
+  sim.runUntilIdle();
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
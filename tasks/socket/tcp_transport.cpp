@@ -1,10 +1,17 @@
 #include "tcp_transport.hpp"
 
+#include <linux/errqueue.h>
+#include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
 #include <cerrno>
+#include <climits>
 #include <cstring>
+#include <utility>
 
 #include "bits/ttl/logger.hpp"
 #include "bits/util.hpp"
@@ -13,6 +20,11 @@
 
 namespace getrafty::rpc {
 
+namespace {
+// Buffers per sendmsg, well under IOV_MAX
+constexpr size_t kMaxBatchIov = 64;
+}  // namespace
+
 TcpTransport::TcpTransport(const Address& address) {
   auto parsed = bits::parseAddress(address);
   if (!parsed) {
@@ -154,12 +166,12 @@ void TcpTransport::close() {
   for (auto& [fd, conn] : connection_by_fd_) {
     unwatchRead(conn);
     unwatchWrite(conn);
+    abortZeroCopy(conn);
     ::close(fd);
   }
 
   connection_by_fd_.clear();
-  fd_by_peer_.clear();
-  hot_read_peer_.clear();
+  read_ready_.clear();
   hot_write_peer_.clear();
 }
 
@@ -190,24 +202,16 @@ void TcpTransport::onAcceptReady() {
           << "(accept) Failed to set TCP_KEEPALIVE errno=" << errno;
     }
 
-    // FIXME
     char ip[INET_ADDRSTRLEN]{};
     ::inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
     uint16_t peer_port = bits::fromNetwork(addr.sin_port);
-    Peer peer          = std::string(ip) + ":" + std::to_string(peer_port);
-
-    connection_by_fd_[fd] = Connection{
-        .fd_          = fd,
-        .peer_        = peer,
-        .read_armed_  = false,
-        .write_armed_ = false,
-    };
-    fd_by_peer_[peer] = fd;
+    auto& conn =
+        admit(fd, std::string(ip) + ":" + std::to_string(peer_port));
 
-    TTL_LOG(bits::ttl::Trace) << "(accept) Accepted connection from " << peer;
+    TTL_LOG(bits::ttl::Trace) << "(accept) Accepted connection from "
+                              << conn.address_ << ", peer=" << conn.id_;
 
-    // FIXME: double lookup
-    watchRead(connection_by_fd_[fd]);
+    watchRead(conn);
   }
 }
 
@@ -241,15 +245,8 @@ void TcpTransport::onConnectReady() {
     return;
   }
 
-  Peer peer                     = *peer_addr;
-  connection_by_fd_[client_fd_] = Connection{
-      .fd_          = client_fd_,
-      .peer_        = peer,
-      .read_armed_  = false,
-      .write_armed_ = false,
-  };
-  fd_by_peer_[peer] = client_fd_;
-  connected_        = true;
+  watchRead(admit(client_fd_, *peer_addr));
+  connected_ = true;
 
   TTL_LOG(bits::ttl::Trace)
       << "(connect) Connected to " << host_ << ":" << port_;
@@ -258,30 +255,61 @@ void TcpTransport::onConnectReady() {
 }
 
 void TcpTransport::onReadReady(int fd) {
-  const auto& it = connection_by_fd_.find(fd);
-  if (it != connection_by_fd_.end()) {
-    hot_read_peer_ = it->second.peer_;
-    TTL_LOG(bits::ttl::Trace)
-        << "(read) Ready fd=" << fd << ", peer=" << hot_read_peer_;
+  const auto it = connection_by_fd_.find(fd);
+  if (it == connection_by_fd_.end()) {
+    return;
+  }
+  auto* conn = &it->second;
+  // Zero-copy completions raise EPOLLERR, which reports as readable
+  if (!conn->zerocopy_sends_.empty()) {
+    const Peer peer   = conn->id_;
+    const bool reaped = reapZeroCopy(*conn);
+    // Completed writes may have closed the connection
+    conn = connectionOf(peer);
+    if (!conn || (reaped && !readable(*conn))) {
+      return;
+    }
+  }
+
+  if (!std::exchange(conn->read_queued_, true)) {
+    read_ready_.push_back(conn->id_);
+  }
+  TTL_LOG(bits::ttl::Trace) << "(read) Ready fd=" << fd
+                            << ", peer=" << conn->id_
+                            << ", ready=" << read_ready_.size();
+  if (!read_suspended_) {
     replay_(ReadReadyRep{});
   }
 }
 
 void TcpTransport::onWriteReady(int fd) {
-  const auto& it = connection_by_fd_.find(fd);
-  if (it != connection_by_fd_.end()) {
-    hot_write_peer_ = it->second.peer_;
-    TTL_LOG(bits::ttl::Trace)
-        << "(write) Ready fd=" << fd << ", peer=" << hot_write_peer_;
-    replay_(WriteReadyRep{.peer = hot_write_peer_});
+  const auto it = connection_by_fd_.find(fd);
+  if (it == connection_by_fd_.end()) {
+    return;
+  }
+  auto* conn = &it->second;
+  // Completions raise EPOLLERR here too, reaped before the write goes on
+  if (!conn->zerocopy_sends_.empty()) {
+    const Peer peer = conn->id_;
+    reapZeroCopy(*conn);
+    conn = connectionOf(peer);
+    if (!conn) {
+      return;
+    }
   }
+
+  hot_write_peer_ = conn->id_;
+  TTL_LOG(bits::ttl::Trace)
+      << "(write) Ready fd=" << fd << ", peer=" << hot_write_peer_;
+  replay_(WriteReadyRep{.peer = hot_write_peer_});
 }
 
 void TcpTransport::watchRead(Connection& conn) {
   if (!conn.read_armed_) {
     TTL_LOG(bits::ttl::Trace)
         << "(read) watchRead before ew->watch fd=" << conn.fd_;
-    ew_->watch(conn.fd_, io::WatchFlag::RDONLY,
+    // Armed once for the life of the connection, reads go on until EAGAIN
+    ew_->watch(conn.fd_, io::WatchFlag::RDONLY | io::WatchFlag::EDGE,
                [this, fd = conn.fd_]() { onReadReady(fd); });
     TTL_LOG(bits::ttl::Trace)
         << "(read) watchRead after ew->watch fd=" << conn.fd_;
@@ -304,7 +332,11 @@ void TcpTransport::unwatchRead(Connection& conn) {
 
 void TcpTransport::watchWrite(Connection& conn) {
   if (!conn.write_armed_) {
-    ew_->watch(conn.fd_, io::WatchFlag::WRONLY,
+    // Armed after EAGAIN only, so the next edge is the buffer draining.
+    // Edge-triggered like reads: interest is per fd, a level write watch
+    // would turn reads level too and EPOLLOUT would fire on every wait
+    // once the queue is empty.
+    ew_->watch(conn.fd_, io::WatchFlag::WRONLY | io::WatchFlag::EDGE,
                [this, fd = conn.fd_]() { onWriteReady(fd); });
     conn.write_armed_ = true;
     TTL_LOG(bits::ttl::Trace) << "(write) Watching fd=" << conn.fd_;
@@ -325,24 +357,66 @@ void TcpTransport::releaseConnection(int fd, IOStatus) {
     return;
   }
 
-  auto& conn = it->second;
-  Peer peer  = conn.peer_;
+  auto& conn         = it->second;
+  const Peer peer    = conn.id_;
+  const auto address = std::move(conn.address_);
 
   unwatchRead(conn);
   unwatchWrite(conn);
+  abortZeroCopy(conn);
   ::close(fd);
 
   connection_by_fd_.erase(it);
-  fd_by_peer_.erase(peer);
 
-  if (hot_read_peer_ == peer) {
-    hot_read_peer_.clear();
-  }
   if (hot_write_peer_ == peer) {
     hot_write_peer_.clear();
   }
 
-  TTL_LOG(bits::ttl::Trace) << "Connection closed " << peer;
+  TTL_LOG(bits::ttl::Trace)
+      << "Connection closed " << address << ", peer=" << peer;
+}
+
+TcpTransport::Connection& TcpTransport::admit(const int fd, Address address) {
+  const Peer id{.index      = static_cast<uint32_t>(fd),
+                .generation = next_generation_++};
+  if (next_generation_ == 0) {
+    // 0 is the empty id
+    next_generation_ = 1;
+  }
+  auto& conn    = connection_by_fd_[fd];
+  conn          = Connection{};
+  conn.fd_      = fd;
+  conn.id_      = id;
+  conn.address_ = std::move(address);
+
+  if (zerocopy_min_size_ > 0) {
+    const int on = 1;
+    conn.zerocopy_ =
+        ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0;
+    if (!conn.zerocopy_) {
+      TTL_LOG(bits::ttl::Error)
+          << "Failed to set SO_ZEROCOPY errno=" << errno << ", fd=" << fd;
+    }
+  }
+  return conn;
+}
+
+TcpTransport::Connection* TcpTransport::connectionOf(const Peer& peer) {
+  // No hashing of addresses: the fd is in the id, the generation rules out
+  // a connection that reused it
+  const auto it = connection_by_fd_.find(static_cast<int>(peer.index));
+  if (it == connection_by_fd_.end() || it->second.id_ != peer) {
+    return nullptr;
+  }
+  return &it->second;
+}
+
+Address TcpTransport::addressOf(const Peer& peer) const {
+  const auto it = connection_by_fd_.find(static_cast<int>(peer.index));
+  if (it == connection_by_fd_.end() || it->second.id_ != peer) {
+    return {};
+  }
+  return it->second.address_;
 }
 
 size_t TcpTransport::resumeRead(Buffer& out_data, Peer& out_peer,
@@ -356,79 +430,70 @@ size_t TcpTransport::resumeRead(Buffer& out_data, Peer& out_peer,
     out_data.resize(offset + capacity);
   }
 
-  // Fast path, read is called right after 'hot_read_peer_' transitioned to ready
-  if (!hot_read_peer_.empty()) {
-    TTL_LOG(bits::ttl::Trace) << "(read) Fast path";
-    const auto& peer_it = fd_by_peer_.find(hot_read_peer_);
-    if (peer_it != fd_by_peer_.end()) {
-      int fd              = peer_it->second;
-      const auto& conn_it = connection_by_fd_.find(fd);
-      if (conn_it != connection_by_fd_.end()) {
-        auto& conn = conn_it->second;
-        ssize_t n =
-            ::recv(fd, out_data.data() + offset, capacity, MSG_DONTWAIT);
-
-        if (n > 0) {
-          out_peer   = conn.peer_;
-          out_status = IOStatus::Ok;
-          if (static_cast<size_t>(n) < capacity) {
-            hot_read_peer_.clear();
-          }
-          TTL_LOG(bits::ttl::Trace)
-              << "(read) Read " << n << " bytes from peer=" << conn.peer_;
-          return n;
-        }
-
-        if (n == 0) {
-          TTL_LOG(bits::ttl::Trace)
-              << "(read) Peer disconnected, peer=" << conn.peer_;
-          hot_read_peer_.clear();
-          releaseConnection(fd, IOStatus::Eof);
-          out_status = IOStatus::Eof;
-          return 0;
-        }
+  const iovec into{.iov_base = out_data.data() + offset, .iov_len = capacity};
+  const auto n = receive({&into, 1}, out_peer, out_status);
+  if (out_status == IOStatus::Ok) {
+    out_data.resize(offset + n);
+  }
+  return n;
+}
 
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-          watchRead(conn);
-          hot_read_peer_.clear();
-          out_status = IOStatus::WouldBlock;
-          TTL_LOG(bits::ttl::Trace)
-              << "(read) Read queued, peer=" << conn.peer_;
-          return 0;
-        }
+size_t TcpTransport::resumeReadv(std::span<const iovec> out_data,
+                                 Peer& out_peer,
+                                 IOStatus& out_status) noexcept {
+  return receive(out_data.first(std::min<size_t>(out_data.size(), IOV_MAX)),
+                 out_peer, out_status);
+}
 
-        TTL_LOG(bits::ttl::Trace)
-            << "(read) Read failed, halting connection for peer=" << conn.peer_;
-        hot_read_peer_.clear();
-        releaseConnection(fd, IOStatus::Fatal);
-        out_status = IOStatus::Fatal;
-        return -1;
-      }
-    }
-    hot_read_peer_.clear();
+size_t TcpTransport::receive(std::span<const iovec> into, Peer& out_peer,
+                             IOStatus& out_status) {
+  size_t capacity = 0;
+  for (const auto& part : into) {
+    capacity += part.iov_len;
+  }
+  if (capacity == 0) {
+    // recvmsg would return 0, which reads as EOF
+    out_status = IOStatus::Error;
+    return 0;
   }
 
-  // Fallback, spurious read
-  TTL_LOG(bits::ttl::Trace) << "(read) Spurious read, scanning "
-                            << connection_by_fd_.size() << " connections";
-  for (auto& [fd, conn] : connection_by_fd_) {
-    if (!conn.read_armed_) {
-      watchRead(conn);
+  // Only connections that reported an edge are read, stale entries of
+  // closed ones are skipped. A connection stays queued until it runs dry.
+  while (!read_ready_.empty()) {
+    auto* ready = connectionOf(read_ready_.front());
+    read_ready_.pop_front();
+    if (!ready) {
+      continue;
     }
-
-    ssize_t n = ::recv(fd, out_data.data() + offset, capacity, MSG_DONTWAIT);
+    auto& conn   = *ready;
+    const int fd = conn.fd_;
+    msghdr msg{};
+    msg.msg_iov    = const_cast<iovec*>(into.data());
+    msg.msg_iovlen = into.size();
+    ssize_t n      = ::recvmsg(fd, &msg, MSG_DONTWAIT);
 
     if (n > 0) {
-      out_peer   = conn.peer_;
+      if (static_cast<size_t>(n) < capacity) {
+        // Drained, more data is a new edge
+        conn.read_queued_ = false;
+      } else {
+        // May have more, other ready connections go first
+        read_ready_.push_back(conn.id_);
+      }
+      out_peer   = conn.id_;
       out_status = IOStatus::Ok;
       TTL_LOG(bits::ttl::Trace)
-          << "(read) Read " << n << " bytes from peer=" << conn.peer_;
+          << "(read) Read " << n << " bytes from peer=" << conn.id_;
       return n;
     }
 
+    conn.read_queued_ = false;
+
     if (n == 0) {
       TTL_LOG(bits::ttl::Trace)
-          << "(read) Peer disconnected, peer=" << conn.peer_;
+          << "(read) Peer disconnected, peer=" << conn.id_;
+      // Caller fails what is still queued for the peer
+      out_peer = conn.id_;
       releaseConnection(fd, IOStatus::Eof);
       out_status = IOStatus::Eof;
       return 0;
@@ -439,109 +504,289 @@ size_t TcpTransport::resumeRead(Buffer& out_data, Peer& out_peer,
     }
 
     TTL_LOG(bits::ttl::Trace)
-        << "(read) Read failed, halting connection for peer=" << conn.peer_;
+        << "(read) Read failed, halting connection for peer=" << conn.id_;
+    out_peer = conn.id_;
     releaseConnection(fd, IOStatus::Fatal);
     out_status = IOStatus::Fatal;
     return -1;
   }
 
-  out_status = IOStatus::WouldBlock;
+  // Caller waits for data, report the next edge
+  read_suspended_ = false;
+  out_status      = IOStatus::WouldBlock;
   return 0;
 }
 
-size_t TcpTransport::resumeWrite(Buffer&& data, const Peer& peer,
-                                 IOStatus& out_status) noexcept {
-  Connection* conn = nullptr;
-
+TcpTransport::Connection* TcpTransport::writeTarget(const Peer& peer,
+                                                    IOStatus& out_status) {
   if (!peer.empty()) {
-    const auto peer_it = fd_by_peer_.find(peer);
-    if (peer_it == fd_by_peer_.end()) {
+    auto* conn = connectionOf(peer);
+    if (!conn) {
       out_status = IOStatus::Fatal;
-      return -1;
     }
+    return conn;
+  }
 
-    const auto conn_it = connection_by_fd_.find(peer_it->second);
-    if (conn_it == connection_by_fd_.end()) {
-      out_status = IOStatus::Fatal;
-      return -1;
-    }
-    conn = &conn_it->second;
-  } else {
-    if (connected_) {
-      const auto conn_it = connection_by_fd_.find(client_fd_);
-      if (conn_it != connection_by_fd_.end()) {
-        conn = &conn_it->second;
-      }
+  if (connected_) {
+    const auto conn_it = connection_by_fd_.find(client_fd_);
+    if (conn_it != connection_by_fd_.end()) {
+      return &conn_it->second;
     }
+  }
+  if (connection_by_fd_.size() == 1) {
+    return &connection_by_fd_.begin()->second;
+  }
+  out_status = IOStatus::Error;
+  return nullptr;
+}
 
-    if (!conn && connection_by_fd_.size() == 1) {
-      conn = &connection_by_fd_.begin()->second;
-    }
+size_t TcpTransport::resumeWrite(Buffer&& data, const Peer& peer,
+                                 IOStatus& out_status) noexcept {
+  auto* conn = writeTarget(peer, out_status);
+  if (!conn) {
+    return -1;
+  }
+  // Copied: the write is done once it returns, there is no WriteDoneRep to
+  // hold it until the kernel lets go of 'data'
+  const iovec from{.iov_base = data.data(), .iov_len = data.size()};
+  return send(*conn, {&from, 1}, out_status);
+}
 
-    if (!conn) {
-      out_status = IOStatus::Error;
-      return -1;
-    }
+size_t TcpTransport::resumeWritev(std::span<const iovec> data,
+                                  const Peer& peer,
+                                  IOStatus& out_status) noexcept {
+  auto* conn = writeTarget(peer, out_status);
+  if (!conn) {
+    return -1;
   }
+  // Longer gathers go out in part, like a short write
+  return send(*conn, data.first(std::min<size_t>(data.size(), IOV_MAX)),
+              out_status);
+}
 
-  auto& resolved_conn = *conn;
-  const int fd        = resolved_conn.fd_;
+size_t TcpTransport::send(Connection& conn, std::span<const iovec> from,
+                          IOStatus& out_status, const bool zerocopy) {
+  const auto empty = [](const iovec& part) { return part.iov_len == 0; };
+  if (std::ranges::all_of(from, empty)) {
+    // sendmsg would return 0, which reads as a closed peer
+    out_status = IOStatus::Ok;
+    return 0;
+  }
+
+  const int fd = conn.fd_;
+  msghdr msg{};
+  msg.msg_iov    = const_cast<iovec*>(from.data());
+  msg.msg_iovlen = from.size();
   // MSG_NOSIGNAL: https://man7.org/linux/man-pages/man2/send.2.html
-  ssize_t n = ::send(fd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+  constexpr int kFlags = MSG_DONTWAIT | MSG_NOSIGNAL;
+  ssize_t n = ::sendmsg(fd, &msg, zerocopy ? kFlags | MSG_ZEROCOPY : kFlags);
+  if (n < 0 && zerocopy && errno == ENOBUFS) {
+    // Out of memory to pin pages with, copying still works
+    n = ::sendmsg(fd, &msg, kFlags);
+  } else if (n > 0 && zerocopy) {
+    conn.zerocopy_sends_.push_back({.id      = conn.zerocopy_next_++,
+                                    .buffers = {},
+                                    .writes  = 0,
+                                    .done    = false});
+  }
 
   if (n > 0) {
-    TTL_LOG(bits::ttl::Trace)
-        << "(write) Wrote " << n << " bytes to peer=" << resolved_conn.peer_;
+    TTL_LOG(bits::ttl::Trace) << "(write) Wrote " << n << " bytes to peer="
+                              << conn.id_ << ", zerocopy=" << zerocopy;
     out_status = IOStatus::Ok;
     return n;
   }
 
   if (n == 0) {
     TTL_LOG(bits::ttl::Trace)
-        << "(read) Peer disconnected, peer=" << resolved_conn.peer_;
+        << "(read) Peer disconnected, peer=" << conn.id_;
     releaseConnection(fd, IOStatus::Eof);
     out_status = IOStatus::Eof;
     return 0;
   }
 
   if (errno == EAGAIN || errno == EWOULDBLOCK) {
-    watchWrite(resolved_conn);
+    watchWrite(conn);
     out_status = IOStatus::WouldBlock;
-    TTL_LOG(bits::ttl::Trace)
-        << "(write) Write queued, peer=" << resolved_conn.peer_;
+    TTL_LOG(bits::ttl::Trace) << "(write) Write queued, peer=" << conn.id_;
     return 0;
   }
 
   TTL_LOG(bits::ttl::Trace)
-      << "(write) Write failed, halting connection for peer="
-      << resolved_conn.peer_;
+      << "(write) Write failed, halting connection for peer=" << conn.id_;
   releaseConnection(fd, IOStatus::Fatal);
   out_status = IOStatus::Fatal;
   return -1;
 }
 
-void TcpTransport::suspendRead() {
-  TTL_LOG(bits::ttl::Trace) << "(read) Suspend for all "
-                            << connection_by_fd_.size() << " connections";
-  for (auto& [fd, conn] : connection_by_fd_) {
-    unwatchRead(conn);
+size_t TcpTransport::resumeWriteBatch(std::span<Buffer> batch,
+                                      const Peer& peer, IOStatus& out_status,
+                                      size_t& out_held) noexcept {
+  out_held   = 0;
+  auto* conn = writeTarget(peer, out_status);
+  if (!conn) {
+    return 0;
+  }
+
+  size_t done = 0;
+  std::array<iovec, kMaxBatchIov> iov{};
+  while (done < batch.size()) {
+    const auto count = std::min(batch.size() - done, iov.size());
+    size_t size      = 0;
+    for (size_t i = 0; i < count; ++i) {
+      iov[i] = {.iov_base = batch[done + i].data(),
+                .iov_len  = batch[done + i].size()};
+      size += iov[i].iov_len;
+    }
+    const auto id = conn->zerocopy_next_;
+    auto sent     = send(*conn, {iov.data(), count}, out_status,
+                         wantsZeroCopy(*conn, size));
+    if (out_status != IOStatus::Ok) {
+      return done;
+    }
+    const bool zerocopy = conn->zerocopy_next_ != id;
+    // Completions keep write order: once the kernel holds a send, later
+    // writes complete with the latest one
+    auto* hold =
+        conn->zerocopy_sends_.empty() ? nullptr : &conn->zerocopy_sends_.back();
+
+    const auto first = done;
+    while (done < batch.size() && sent >= batch[done].size()) {
+      sent -= batch[done].size();
+      ++done;
+    }
+    if (hold) {
+      hold->writes += done - first;
+      out_held     += done - first;
+    }
+    if (zerocopy) {
+      for (auto i = first; i < done; ++i) {
+        hold->buffers.push_back(std::move(batch[i]));
+      }
+    }
+    if (sent > 0) {
+      // Socket buffer is full, the rest waits for it to drain
+      auto& partial = batch[done];
+      if (zerocopy) {
+        // Kernel reads the sent part in place, the rest is resent from a
+        // copy
+        Buffer rest(partial.begin() + static_cast<ptrdiff_t>(sent),
+                    partial.end());
+        hold->buffers.push_back(std::move(partial));
+        partial = std::move(rest);
+      } else {
+        partial.erase(partial.begin(),
+                      partial.begin() + static_cast<ptrdiff_t>(sent));
+      }
+      watchWrite(*conn);
+      out_status = IOStatus::WouldBlock;
+      return done;
+    }
   }
+
+  out_status = IOStatus::Ok;
+  return done;
 }
 
-void TcpTransport::suspendWrite(const Peer& peer) {
-  const auto& peer_it = fd_by_peer_.find(peer);
-  if (peer_it == fd_by_peer_.end()) {
+void TcpTransport::enableZeroCopy(const size_t min_size) {
+  zerocopy_min_size_ = std::max<size_t>(min_size, 1);
+}
+
+bool TcpTransport::wantsZeroCopy(const Connection& conn,
+                                 const size_t size) const {
+  return conn.zerocopy_ && size >= zerocopy_min_size_;
+}
+
+bool TcpTransport::collectZeroCopy(Connection& conn) {
+  bool collected = false;
+  while (!conn.zerocopy_sends_.empty()) {
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err))];
+    msghdr msg{};
+    msg.msg_control    = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(conn.fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      break;
+    }
+    collected = true;
+    for (auto* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg       = CMSG_NXTHDR(&msg, cmsg)) {
+      if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) &&
+          !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+        continue;
+      }
+      sock_extended_err err{};
+      std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+      if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+        continue;
+      }
+      // Sends ee_info through ee_data are done, ranges may come out of
+      // order and the counter wraps
+      for (auto& send : conn.zerocopy_sends_) {
+        if (send.id - err.ee_info <= err.ee_data - err.ee_info) {
+          send.done = true;
+        }
+      }
+    }
+  }
+  return collected;
+}
+
+bool TcpTransport::reapZeroCopy(Connection& conn) {
+  const bool collected = collectZeroCopy(conn);
+  size_t writes        = 0;
+  while (!conn.zerocopy_sends_.empty() && conn.zerocopy_sends_.front().done) {
+    writes += conn.zerocopy_sends_.front().writes;
+    conn.zerocopy_sends_.pop_front();
+  }
+  if (writes > 0) {
+    TTL_LOG(bits::ttl::Trace) << "(write) Kernel done with " << writes
+                              << " writes to peer=" << conn.id_;
+    replay_(WriteDoneRep{
+        .peer = conn.id_, .count = writes, .status = IOStatus::Ok});
+  }
+  return collected;
+}
+
+void TcpTransport::abortZeroCopy(Connection& conn) {
+  // Writes of a closing connection fail anyway, no WriteDoneRep
+  collectZeroCopy(conn);
+  const bool held =
+      std::ranges::any_of(conn.zerocopy_sends_,
+                          [](const ZeroCopySend& send) { return !send.done; });
+  if (!held) {
     return;
   }
+  // Closing with an empty linger discards the send queue: the kernel sends
+  // nothing more from the buffers, the pages it pinned stay its own
+  TTL_LOG(bits::ttl::Trace)
+      << "(write) Resetting peer=" << conn.id_ << " with zero-copy sends held";
+  const linger reset{.l_onoff = 1, .l_linger = 0};
+  ::setsockopt(conn.fd_, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+}
 
-  int fd              = peer_it->second;
-  const auto& conn_it = connection_by_fd_.find(fd);
-  if (conn_it == connection_by_fd_.end()) {
+bool TcpTransport::readable(const Connection& conn) {
+  char byte;
+  return ::recv(conn.fd_, &byte, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 ||
+         (errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+void TcpTransport::suspendRead() {
+  // Reads stay armed for the life of a connection: edges keep queueing in
+  // 'read_ready_' but are not reported until the next resumeRead runs dry,
+  // unwatching and rewatching every connection would cost two syscalls each
+  read_suspended_ = true;
+  TTL_LOG(bits::ttl::Trace)
+      << "(read) Suspend, ready=" << read_ready_.size();
+}
+
+void TcpTransport::suspendWrite(const Peer& peer) {
+  auto* conn = connectionOf(peer);
+  if (!conn) {
     return;
   }
 
   TTL_LOG(bits::ttl::Trace) << "(write) Suspend for per=" << peer;
-  unwatchWrite(conn_it->second);
+  unwatchWrite(*conn);
 }
 
 }  // namespace getrafty::rpc
@@ -1,14 +1,20 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <span>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include "transport.hpp"
 
 namespace getrafty::rpc {
 
 class TcpTransport : public ITransport {
  public:
+  static constexpr size_t kDefaultZeroCopyMinSize = 32 << 10;  // 32KB
+
   explicit TcpTransport(const Address& address);
   ~TcpTransport() override                     = default;
   TcpTransport(TcpTransport&&)                 = default;
@@ -26,18 +32,59 @@ class TcpTransport : public ITransport {
   size_t resumeRead(Buffer& out_data, Peer& out_peer, IOStatus& out_status,
                     size_t offset, size_t max_len) noexcept override;
   void suspendRead() override;
+  size_t resumeReadv(std::span<const iovec> out_data, Peer& out_peer,
+                     IOStatus& out_status) noexcept override;
 
   size_t resumeWrite(Buffer&& data, const Peer& peer,
                      IOStatus& out_status) noexcept override;
 
   void suspendWrite(const Peer& peer) override;
 
+  size_t resumeWritev(std::span<const iovec> data, const Peer& peer,
+                      IOStatus& out_status) noexcept override;
+  size_t resumeWriteBatch(std::span<Buffer> batch, const Peer& peer,
+                          IOStatus& out_status,
+                          size_t& out_held) noexcept override;
+
+  [[nodiscard]] Address addressOf(const Peer& peer) const override;
+
+  // Off by default. Batched writes (resumeWriteBatch) of at least
+  // 'min_size' bytes go out with MSG_ZEROCOPY: the kernel sends from the
+  // buffer itself instead of copying it, and the transport keeps the buffer
+  // until the error queue reports the kernel done. The writes complete with
+  // WriteDoneRep then. Copies are cheaper for small writes. A connection
+  // closed while the kernel still holds such writes is reset, so nothing
+  // goes out from buffers the transport frees. Writes through
+  // FramedTransport stay copied: it passes frames down one resumeWrite at a
+  // time. Call before bind or connect.
+  void enableZeroCopy(size_t min_size = kDefaultZeroCopyMinSize);
+
  private:
+  struct ZeroCopySend {
+    // Kernel's sequence number of the send
+    uint32_t id{0};
+    // Kernel reads from these until the send is done
+    std::vector<Buffer> buffers;
+    // Batched writes that complete with this send
+    size_t writes{0};
+    bool done{false};
+  };
+
   struct Connection {
     int fd_{-1};
-    std::string peer_;
+    // Index is the fd
+    Peer id_;
+    Address address_;
     bool read_armed_{false};
     bool write_armed_{false};
+    // In 'read_ready_'
+    bool read_queued_{false};
+    // SO_ZEROCOPY is on
+    bool zerocopy_{false};
+    // Sequence number the kernel gives the next MSG_ZEROCOPY send
+    uint32_t zerocopy_next_{0};
+    // Sends the kernel may still read from, oldest first
+    std::deque<ZeroCopySend> zerocopy_sends_;
   };
 
   // Low-level I/O handlers
@@ -55,21 +102,56 @@ class TcpTransport : public ITransport {
   void watchWrite(Connection& conn);
   void unwatchWrite(Connection& conn);
 
+  Connection& admit(int fd, Address address);
+  // Null if 'peer' is closed
+  Connection* connectionOf(const Peer& peer);
+  // Connection a write to 'peer' goes to, empty 'peer' for the only one.
+  // Null with 'out_status' set if there is none.
+  Connection* writeTarget(const Peer& peer, IOStatus& out_status);
   void releaseConnection(int fd, IOStatus status);
 
+  // Next ready connection into 'into', as resumeRead
+  size_t receive(std::span<const iovec> into, Peer& out_peer,
+                 IOStatus& out_status);
+  // One sendmsg of 'from' to 'conn', as resumeWrite. A send that went out
+  // with 'zerocopy' adds an entry to 'zerocopy_sends_', whoever owns 'from'
+  // puts the buffers in it.
+  size_t send(Connection& conn, std::span<const iovec> from,
+              IOStatus& out_status, bool zerocopy = false);
+  [[nodiscard]] bool wantsZeroCopy(const Connection& conn,
+                                   size_t size) const;
+  // Drains the error queue and marks the sends the kernel is done with,
+  // returns whether there was anything to drain
+  bool collectZeroCopy(Connection& conn);
+  // Collects, releases what the kernel is done with and completes its
+  // writes. Returns whether the error queue had anything, as collect.
+  bool reapZeroCopy(Connection& conn);
+  // Before close: resets the connection if the kernel still holds sends,
+  // so their buffers can go with it
+  void abortZeroCopy(Connection& conn);
+  // Reading would not block, EOF and errors included
+  [[nodiscard]] static bool readable(const Connection& conn);
+
   std::string host_;
   uint16_t port_;
   int listen_fd_{-1};
   int client_fd_{-1};
-  Peer hot_read_peer_;
   Peer hot_write_peer_;
   bool connected_{false};
 
   io::EventWatcher* ew_;
   Fn<IOEvent&&> replay_;
 
-  std::unordered_map<Peer, int> fd_by_peer_;
   std::unordered_map<int, Connection> connection_by_fd_;
+  // Connections with unread data, in the order they turned ready
+  std::deque<Peer> read_ready_;
+  // No reader waits, readiness is queued without ReadReadyRep until a
+  // resumeRead comes back WouldBlock
+  bool read_suspended_{false};
+  // Of the next connection, never 0
+  uint32_t next_generation_{1};
+  // 0 is off
+  size_t zerocopy_min_size_{0};
 };
 
 }  // namespace getrafty::rpc
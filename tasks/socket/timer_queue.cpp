@@ -0,0 +1,94 @@
+#include "timer_queue.hpp"
+
+#include <algorithm>
+#include <bits/ttl/logger.hpp>
+#include <exception>
+#include <functional>
+#include <utility>
+
+namespace getrafty::io {
+
+namespace {
+// Leftovers of cancelled timers tolerated before the heap is rebuilt
+constexpr size_t kMinStaleEntries = 64;
+}  // namespace
+
+void TimerQueue::add(const TimerId id, const Clock::time_point deadline,
+                     const Clock::duration period, TimerCallback callback) {
+  timers_.insert_or_assign(
+      id, Timer{.period   = period,
+                .callback = std::make_shared<TimerCallback>(
+                    std::move(callback))});
+  push({.deadline = deadline, .id = id});
+}
+
+void TimerQueue::cancel(const TimerId id) {
+  if (timers_.erase(id) > 0 &&
+      heap_.size() > 2 * timers_.size() + kMinStaleEntries) {
+    compact();
+  }
+}
+
+std::optional<TimerQueue::Clock::time_point> TimerQueue::runExpired(
+    const Clock::time_point now) {
+  while (!heap_.empty() && heap_.front().deadline <= now) {
+    const auto entry = heap_.front();
+    pop();
+
+    const auto it = timers_.find(entry.id);
+    if (it == timers_.end()) {
+      // Cancelled
+      continue;
+    }
+
+    // Callback may cancel its own timer or add new ones
+    auto callback = it->second.callback;
+    if (it->second.period > Clock::duration::zero()) {
+      // Keep the cadence, but do not replay periods missed while stalled
+      auto next = entry.deadline + it->second.period;
+      if (next <= now) {
+        next = now + it->second.period;
+      }
+      push({.deadline = next, .id = entry.id});
+    } else {
+      timers_.erase(it);
+    }
+
+    try {
+      (*callback)();
+    } catch (const std::exception& ex) {
+      TTL_LOG(bits::ttl::Error) << "Exception in timer: " << ex.what();
+    } catch (...) {
+      TTL_LOG(bits::ttl::Error) << "Unknown exception in timer";
+    }
+  }
+
+  // Leftovers at the top would shorten the next wait for nothing
+  while (!heap_.empty() && !timers_.contains(heap_.front().id)) {
+    pop();
+  }
+  if (heap_.empty()) {
+    return std::nullopt;
+  }
+  return heap_.front().deadline;
+}
+
+void TimerQueue::push(const Entry entry) {
+  heap_.push_back(entry);
+  std::push_heap(heap_.begin(), heap_.end(), std::greater<>{});
+}
+
+void TimerQueue::pop() {
+  std::pop_heap(heap_.begin(), heap_.end(), std::greater<>{});
+  heap_.pop_back();
+}
+
+void TimerQueue::compact() {
+  std::erase_if(heap_,
+                [this](const Entry& entry) {
+                  return !timers_.contains(entry.id);
+                });
+  std::make_heap(heap_.begin(), heap_.end(), std::greater<>{});
+}
+
+}  // namespace getrafty::io
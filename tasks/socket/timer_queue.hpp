@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace getrafty::io {
+
+using TimerId       = uint64_t;
+using TimerCallback = std::move_only_function<void()>;
+
+constexpr TimerId kInvalidTimer = 0;
+
+// Timers of one event loop, not thread-safe.
+//
+// Deadlines live in a binary min-heap, so add and each expiry cost
+// O(log n). Cancel only drops the timer from the id map and leaves its
+// heap entry behind to be skipped when it surfaces; the heap is compacted
+// once such leftovers outnumber live timers.
+class TimerQueue {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Zero 'period' fires once
+  void add(TimerId id, Clock::time_point deadline, Clock::duration period,
+           TimerCallback callback);
+
+  void cancel(TimerId id);
+
+  // Fires every timer due at 'now', returns deadline of the next one
+  std::optional<Clock::time_point> runExpired(Clock::time_point now);
+
+  [[nodiscard]] bool empty() const { return timers_.empty(); }
+
+  [[nodiscard]] size_t size() const { return timers_.size(); }
+
+ private:
+  struct Entry {
+    Clock::time_point deadline;
+    TimerId id;
+
+    bool operator>(const Entry& that) const {
+      return deadline > that.deadline;
+    }
+  };
+
+  struct Timer {
+    Clock::duration period;
+    std::shared_ptr<TimerCallback> callback;
+  };
+
+  void push(Entry entry);
+  void pop();
+  void compact();
+
+  std::vector<Entry> heap_;
+  std::unordered_map<TimerId, Timer> timers_;
+};
+
+}  // namespace getrafty::io
@@ -1,9 +1,18 @@
 #pragma once
 
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <ostream>
+#include <span>
 #include <string>
+#include <utility>
 #include <variant>
+#include <vector>
 
 namespace getrafty::io {
 class EventWatcher;
@@ -26,7 +35,28 @@ using Address = std::string;
 
 using Buffer = std::vector<uint8_t>;
 
-using Peer = std::string;
+// Handle of one connection of a transport, cheap to copy, hash and compare.
+// 'index' is the transport's slot for the connection (an fd for TCP), the
+// generation tells a closed connection from the one reusing its slot. A
+// default constructed id names no connection: a connected socket writes to
+// its only peer with it. The address behind an id is resolved on demand
+// with ITransport::addressOf.
+struct ConnectionId {
+  uint32_t index{0};
+  uint32_t generation{0};
+
+  [[nodiscard]] bool empty() const { return generation == 0; }
+
+  void clear() { *this = {}; }
+
+  auto operator<=>(const ConnectionId&) const = default;
+};
+
+inline std::ostream& operator<<(std::ostream& out, const ConnectionId& id) {
+  return out << '#' << id.index << '.' << id.generation;
+}
+
+using Peer = ConnectionId;
 
 struct BindReq {
   Fn<IOStatus, Address> callback;
@@ -65,10 +95,16 @@ struct WriteReadyRep {
   Peer peer;
 };
 
+// Device is done with 'count' writes to 'peer' it held on to, oldest first
+struct WriteDoneRep {
+  Peer peer;
+  size_t count;
+  IOStatus status;
+};
 
 using IOEvent = std::variant<BindReq, BindRep, ConnectReq, ConnectRep, ReadReq,
                              ReadReadyRep, WriteReq, WriteReadyRep,
-                             CloseReq>;
+                             WriteDoneRep, CloseReq>;
 
 struct ITransport {
   virtual ~ITransport() = default;
@@ -80,14 +116,104 @@ struct ITransport {
   virtual void close()                                            = 0;
 
   // I/O
+  // Reads at most 'max_len' bytes, a transport default if 0, into
+  // 'out_data' from 'offset' on. On Ok 'out_data' ends right after the
+  // bytes read.
   virtual size_t resumeRead(Buffer& out_data, Peer& out_peer,
                             IOStatus& out_status, size_t offset = 0,
                             size_t max_len = 0) noexcept = 0;
+  // No read is pending: ReadReadyRep may stop until a resumeRead comes
+  // back WouldBlock. Data that arrives meanwhile waits for that resumeRead.
   virtual void suspendRead()                             = 0;
-
+  // Scatter read: fills 'out_data' in order, as resumeRead with 'max_len'
+  // their total size. Error without reading if they have no room.
+  virtual size_t resumeReadv(std::span<const iovec> out_data, Peer& out_peer,
+                             IOStatus& out_status) noexcept {
+    size_t capacity = 0;
+    for (const auto& part : out_data) {
+      capacity += part.iov_len;
+    }
+    if (capacity == 0) {
+      // resumeRead would take 0 for its default size
+      out_status = IOStatus::Error;
+      return 0;
+    }
+    Buffer data;
+    const auto n = resumeRead(data, out_peer, out_status, 0, capacity);
+    if (out_status != IOStatus::Ok) {
+      return n;
+    }
+    size_t copied = 0;
+    for (const auto& part : out_data) {
+      const auto len = std::min(part.iov_len, n - copied);
+      std::copy_n(data.data() + copied, len,
+                  static_cast<uint8_t*>(part.iov_base));
+      copied += len;
+    }
+    return n;
+  }
+
+  // Ok with fewer bytes than 'data' holds is a short write: 'data' is then
+  // left as it was, for the caller to send the rest.
   virtual size_t resumeWrite(Buffer&& data, const Peer& peer,
                              IOStatus& out_status) noexcept = 0;
   virtual void suspendWrite(const Peer& peer)               = 0;
+  // Gather write: 'data' goes out back to back as one message, as if it was
+  // one buffer passed to resumeWrite. Nothing to write is Ok right away.
+  virtual size_t resumeWritev(std::span<const iovec> data, const Peer& peer,
+                              IOStatus& out_status) noexcept {
+    Buffer joined;
+    for (const auto& part : data) {
+      const auto* begin = static_cast<const uint8_t*>(part.iov_base);
+      joined.insert(joined.end(), begin, begin + part.iov_len);
+    }
+    if (joined.empty()) {
+      out_status = IOStatus::Ok;
+      return 0;
+    }
+    return resumeWrite(std::move(joined), peer, out_status);
+  }
+
+  // Writes 'batch' to 'peer' back to back, in one syscall where the
+  // transport can. Returns how many buffers went out completely; one the
+  // transport stopped in is trimmed to what is left. Status as for
+  // resumeWrite, WouldBlock if the rest has to wait for WriteReadyRep.
+  // The last 'out_held' of the buffers done are still being read by the
+  // device (zero copy), they complete later with WriteDoneRep.
+  virtual size_t resumeWriteBatch(std::span<Buffer> batch, const Peer& peer,
+                                  IOStatus& out_status,
+                                  size_t& out_held) noexcept {
+    out_status  = IOStatus::Ok;
+    out_held    = 0;
+    size_t done = 0;
+    for (auto& data : batch) {
+      // A short write sends the rest until the transport blocks: only it
+      // knows when to raise WriteReadyRep
+      for (auto size = data.size();; size = data.size()) {
+        const auto n = resumeWrite(std::move(data), peer, out_status);
+        if (out_status != IOStatus::Ok) {
+          return done;
+        }
+        if (n >= size) {
+          break;
+        }
+        data.erase(data.begin(), data.begin() + static_cast<ptrdiff_t>(n));
+      }
+      ++done;
+    }
+    return done;
+  }
+
+  // "host:port" of a live connection, empty if 'peer' is gone
+  [[nodiscard]] virtual Address addressOf(const Peer& peer) const = 0;
 };
 
 }  // namespace getrafty::rpc
+
+template <>
+struct std::hash<getrafty::rpc::ConnectionId> {
+  size_t operator()(const getrafty::rpc::ConnectionId& id) const noexcept {
+    return std::hash<uint64_t>{}(
+        (static_cast<uint64_t>(id.generation) << 32) | id.index);
+  }
+};
@@ -0,0 +1,423 @@
+#include "uring_event_watcher.hpp"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <bits/ttl/logger.hpp>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+namespace getrafty::io {
+
+namespace detail {
+namespace {
+template <typename T>
+T* at(void* base, const uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+}  // namespace
+
+Uring::Uring(const unsigned entries) {
+  io_uring_params params{};
+  ring_fd_ =
+      static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+  if (ring_fd_ < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Failed to create io_uring");
+  }
+  // Timed waits need EXT_ARG; without NODROP a full CQ ring loses events
+  constexpr auto kRequired = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+  if ((params.features & kRequired) != kRequired) {
+    ::close(ring_fd_);
+    throw std::system_error(ENOTSUP, std::generic_category(),
+                            "io_uring lacks EXT_ARG or NODROP");
+  }
+
+  sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+  }
+
+  auto map = [this](const size_t size, const off_t offset) {
+    void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    if (ptr == MAP_FAILED) {
+      const int error = errno;
+      unmap();
+      ::close(ring_fd_);
+      throw std::system_error(error, std::generic_category(),
+                              "Failed to map io_uring");
+    }
+    return ptr;
+  };
+
+  sq_ptr_    = map(sq_size_, IORING_OFF_SQ_RING);
+  cq_ptr_    = single_mmap ? sq_ptr_ : map(cq_size_, IORING_OFF_CQ_RING);
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  sqes_      = static_cast<io_uring_sqe*>(map(sqes_size_, IORING_OFF_SQES));
+
+  sq_head_    = at<unsigned>(sq_ptr_, params.sq_off.head);
+  sq_tail_    = at<unsigned>(sq_ptr_, params.sq_off.tail);
+  sq_mask_    = at<unsigned>(sq_ptr_, params.sq_off.ring_mask);
+  sq_entries_ = at<unsigned>(sq_ptr_, params.sq_off.ring_entries);
+  sq_array_   = at<unsigned>(sq_ptr_, params.sq_off.array);
+  sq_flags_   = at<unsigned>(sq_ptr_, params.sq_off.flags);
+
+  cq_head_ = at<unsigned>(cq_ptr_, params.cq_off.head);
+  cq_tail_ = at<unsigned>(cq_ptr_, params.cq_off.tail);
+  cq_mask_     = at<unsigned>(cq_ptr_, params.cq_off.ring_mask);
+  cq_overflow_ = at<unsigned>(cq_ptr_, params.cq_off.overflow);
+  cqes_        = at<io_uring_cqe>(cq_ptr_, params.cq_off.cqes);
+
+  // Slot i always holds sqe i, so the array never has to be touched again
+  for (unsigned i = 0; i < *sq_entries_; ++i) {
+    sq_array_[i] = i;
+  }
+}
+
+Uring::~Uring() {
+  unmap();
+  ::close(ring_fd_);
+}
+
+void Uring::unmap() {
+  if (sqes_ != nullptr) {
+    ::munmap(sqes_, sqes_size_);
+  }
+  if (cq_ptr_ != nullptr && cq_ptr_ != sq_ptr_) {
+    ::munmap(cq_ptr_, cq_size_);
+  }
+  if (sq_ptr_ != nullptr) {
+    ::munmap(sq_ptr_, sq_size_);
+  }
+}
+
+io_uring_sqe* Uring::nextSqe() {
+  const auto tail = *sq_tail_;
+  while (tail - std::atomic_ref(*sq_head_).load(std::memory_order_acquire) ==
+         *sq_entries_) {
+    submitAndWait(0);
+  }
+
+  auto* sqe = &sqes_[tail & *sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  // Published to the kernel by the next submitAndWait
+  std::atomic_ref(*sq_tail_).store(tail + 1, std::memory_order_release);
+  ++to_submit_;
+  return sqe;
+}
+
+int Uring::submitAndWait(
+    const unsigned min_complete,
+    const std::optional<std::chrono::nanoseconds> timeout) {
+  if (to_submit_ == 0 && min_complete == 0) {
+    return 0;
+  }
+
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  __kernel_timespec ts{};
+  io_uring_getevents_arg arg{};
+  if (timeout && min_complete > 0) {
+    ts.tv_sec  = timeout->count() / 1'000'000'000;
+    ts.tv_nsec = timeout->count() % 1'000'000'000;
+    arg.ts     = reinterpret_cast<uint64_t>(&ts);
+    flags |= IORING_ENTER_EXT_ARG;
+  }
+
+  const auto submitted =
+      enter(to_submit_, min_complete, flags,
+            (flags & IORING_ENTER_EXT_ARG) != 0 ? &arg : nullptr,
+            (flags & IORING_ENTER_EXT_ARG) != 0 ? sizeof(arg) : 0);
+  to_submit_ -= static_cast<unsigned>(submitted);
+  return submitted;
+}
+
+void Uring::flushOverflow() {
+  // Submits what is queued as well, the kernel takes both in one call
+  to_submit_ -= static_cast<unsigned>(
+      enter(to_submit_, 0, IORING_ENTER_GETEVENTS, nullptr, 0));
+}
+
+int Uring::enter(const unsigned to_submit, const unsigned min_complete,
+                 const unsigned flags, const void* arg,
+                 const size_t arg_size) {
+  const auto submitted = static_cast<int>(
+      ::syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                flags, arg, arg_size));
+  if (submitted < 0) {
+    // ETIME: timeout passed with nothing completed
+    if (errno != EINTR && errno != EAGAIN && errno != EBUSY &&
+        errno != ETIME) {
+      TTL_LOG(bits::ttl::Critical)
+          << "io_uring_enter failed: errno=" << errno;
+    }
+    return 0;
+  }
+  return submitted;
+}
+}  // namespace detail
+
+UringEventWatcher::UringEventWatcher(const unsigned entries)
+    : EventWatcher(NoLoop{}), ring_(entries) {
+  startLoopThread([this] { waitLoop(); });
+}
+
+UringEventWatcher::~UringEventWatcher() {
+  // Loop uses the ring, stop it while the ring is still there
+  stopLoopThread();
+}
+
+void UringEventWatcher::waitLoop() {
+  bindLoopThread();
+  armDoorbell();
+
+  while (running()) {
+    wait();
+    beginIteration(LoopMonitor::Clock::now());
+    reapAll();
+  }
+}
+
+void UringEventWatcher::wait() {
+  auto& timers   = timerQueue();
+  bool hooks_ran = false;
+  while (true) {
+    runPendingTasks();
+    runTimerOps();
+    const auto next_timer =
+        timers.empty() ? std::nullopt
+                       : timers.runExpired(TimerQueue::Clock::now());
+    if (!hooks_ran) {
+      // Work queued by a hook runs in this iteration, hooks do not run again
+      hooks_ran = true;
+      runBeforeWaitHooks();
+    }
+
+    // Tasks left over by the budget must not wait for I/O
+    if (taskBacklog()) {
+      ring_.submitAndWait(0);
+      return;
+    }
+    // From here on producers have to ring the doorbell
+    if (!prepareToSleep()) {
+      if (!running()) {
+        return;
+      }
+      // Tasks arrived after the drain, their producers saw us awake
+      continue;
+    }
+
+    beforeWait(LoopMonitor::Clock::now());
+    if (next_timer) {
+      const auto left = std::max(*next_timer - TimerQueue::Clock::now(),
+                                 TimerQueue::Clock::duration::zero());
+      ring_.submitAndWait(1, left);
+    } else {
+      ring_.submitAndWait(1);
+    }
+    awake();
+    return;
+  }
+}
+
+void UringEventWatcher::reapAll() {
+  const auto on_completion = [this](const io_uring_cqe& cqe) {
+    onCompletion(cqe);
+  };
+  ring_.reap(on_completion);
+  // Multishot polls end on overflow and are re-armed by onCompletion, but
+  // what the kernel held back has to be flushed into the ring first
+  while (ring_.overflowed()) {
+    ring_.flushOverflow();
+    if (ring_.reap(on_completion) == 0) {
+      break;
+    }
+  }
+  if (const auto dropped = ring_.dropped(); dropped != dropped_) {
+    TTL_LOG(bits::ttl::Critical)
+        << "io_uring dropped " << dropped - dropped_ << " completions";
+    dropped_ = dropped;
+  }
+}
+
+void UringEventWatcher::armDoorbell() {
+  // Multishot poll rather than a read: nothing for the kernel to write
+  // into, and a read of a blocking fd would go to the io-wq workers
+  auto* sqe          = ring_.nextSqe();
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = wakeupFd();
+  sqe->poll32_events = POLLIN;
+  sqe->len           = IORING_POLL_ADD_MULTI;
+  sqe->user_data     = kDoorbellToken;
+}
+
+void UringEventWatcher::armPoll(const int fd, const WatchFlag flag,
+                                Watch& watch) {
+  auto* sqe          = ring_.nextSqe();
+  sqe->opcode        = IORING_OP_POLL_ADD;
+  sqe->fd            = fd;
+  sqe->poll32_events = flag == RDONLY ? POLLIN : POLLOUT;
+  // Multishot poll reports transitions only, just what EDGE asks for. The
+  // kernel takes no level-triggered multishot, so other watches are single
+  // shot; a poll armed on a ready fd completes right away.
+  sqe->len       = edgeTriggered(watch) ? IORING_POLL_ADD_MULTI : 0;
+  sqe->user_data = watch.token;
+
+  watch.armed = true;
+}
+
+void UringEventWatcher::cancelPoll(const uint64_t token) {
+  auto* sqe      = ring_.nextSqe();
+  sqe->opcode    = IORING_OP_POLL_REMOVE;
+  sqe->addr      = token;
+  sqe->user_data = kIgnoredToken;
+}
+
+void UringEventWatcher::onCompletion(const io_uring_cqe& cqe) {
+  if (cqe.user_data == kDoorbellToken) {
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+      if (cqe.res < 0) {
+        TTL_LOG(bits::ttl::Error) << "Doorbell poll failed: res=" << cqe.res;
+      }
+      if (running()) {
+        armDoorbell();
+      }
+    }
+    // Tasks that rang it run at the top of the next iteration
+    drainWakeup();
+    return;
+  }
+
+  const auto token  = cqe.user_data;
+  const auto key_it = key_by_token_.find(token);
+  if (key_it == key_by_token_.end()) {
+    // Poll was removed while this completion was in flight
+    return;
+  }
+  const auto key        = key_it->second;
+  auto& watch           = watches_.find(key)->second;
+  const bool terminated = (cqe.flags & IORING_CQE_F_MORE) == 0;
+  if (terminated) {
+    watch.armed = false;
+  }
+  if (cqe.res < 0) {
+    TTL_LOG(bits::ttl::Error)
+        << "Poll failed fd=" << key.first << ": res=" << cqe.res;
+    return;
+  }
+  if (terminated && edgeTriggered(watch)) {
+    // Kernel terminated the multishot request, e.g. on CQ overflow
+    armPoll(key.first, key.second, watch);
+  }
+
+  // Callback may unwatch or re-watch, 'watch' is not to be touched after
+  if (auto callback = watch.callback) {
+    const auto start = LoopMonitor::Clock::now();
+    try {
+      callback->operator()();
+    } catch (std::exception& e) {
+      TTL_LOG(bits::ttl::Error) << "Unhandled error in callback: " << e.what();
+    } catch (...) {
+      TTL_LOG(bits::ttl::Error) << "Unhandled error in callback";
+    }
+    recordCallback(LoopMonitor::Clock::now() - start);
+  }
+
+  // Level-triggered: fires again if the callback left the fd ready
+  const auto it = watches_.find(key);
+  if (it != watches_.end() && it->second.token == token &&
+      !it->second.armed && (it->second.modifiers & ONESHOT) == 0) {
+    armPoll(key.first, key.second, it->second);
+  }
+}
+
+void UringEventWatcher::watch(const int fd, const WatchFlag flag,
+                              WatchCallback callback) {
+  if (running()) {
+    dispatch(
+        [this, fd, flag,
+         cb = std::make_shared<WatchCallback>(std::move(callback))] mutable {
+          const W key{fd, directionOf(flag)};
+          const auto modifiers =
+              static_cast<WatchFlag>(flag & (EDGE | ONESHOT));
+
+          auto it = watches_.find(key);
+          if (it != watches_.end() && it->second.modifiers != modifiers) {
+            // Request kind changes, replace the poll
+            if (it->second.armed) {
+              cancelPoll(it->second.token);
+            }
+            key_by_token_.erase(it->second.token);
+            watches_.erase(it);
+            it = watches_.end();
+          }
+
+          if (it == watches_.end()) {
+            const auto token = next_token_++;
+            it = watches_
+                     .emplace(key, Watch{.token     = token,
+                                         .callback  = std::move(cb),
+                                         .modifiers = modifiers,
+                                         .armed     = false})
+                     .first;
+            key_by_token_.emplace(token, key);
+          } else {
+            it->second.callback = std::move(cb);
+          }
+
+          // Watching again re-arms a fired one-shot poll
+          if (!it->second.armed) {
+            armPoll(key.first, key.second, it->second);
+          }
+        });
+  }
+}
+
+void UringEventWatcher::unwatch(const int fd, const WatchFlag flag) {
+  if (running()) {
+    dispatch([this, fd, flag] {
+      const auto it = watches_.find({fd, directionOf(flag)});
+      if (it == watches_.end()) {
+        return;
+      }
+      if (it->second.armed) {
+        cancelPoll(it->second.token);
+      }
+      key_by_token_.erase(it->second.token);
+      watches_.erase(it);
+    });
+  }
+}
+
+void UringEventWatcher::unwatchAll() {
+  if (running()) {
+    dispatch([this] {
+      for (const auto& [_, watch] : watches_) {
+        if (watch.armed) {
+          cancelPoll(watch.token);
+        }
+      }
+      watches_.clear();
+      key_by_token_.clear();
+    });
+  }
+}
+
+void UringEventWatcher::runInEventWatcherLoop(WatchCallback task) {
+  post(std::move(task));
+}
+
+}  // namespace getrafty::io
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <linux/io_uring.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+#include "event_watcher.hpp"
+#include "hash.hpp"
+
+namespace getrafty::io {
+
+namespace detail {
+// Minimal io_uring wrapper over the raw syscalls, owned by one thread
+class Uring {
+ public:
+  explicit Uring(unsigned entries);
+  ~Uring();
+
+  // Non-copyable
+  Uring(const Uring&) = delete;
+
+  Uring& operator=(const Uring&) = delete;
+
+  // Non-movable
+  Uring(Uring&&) = delete;
+
+  // Next free submission slot, zeroed. Flushes the queue if it is full.
+  io_uring_sqe* nextSqe();
+
+  // Submits everything queued so far and waits for at least 'min_complete'
+  // completions or until 'timeout' passes, one syscall
+  int submitAndWait(unsigned min_complete,
+                    std::optional<std::chrono::nanoseconds> timeout = {});
+
+  // Kernel holds completions back while the CQ ring is full
+  [[nodiscard]] bool overflowed() const {
+    return (std::atomic_ref(*sq_flags_).load(std::memory_order_acquire) &
+            IORING_SQ_CQ_OVERFLOW) != 0;
+  }
+
+  // Moves completions held back by the kernel into the ring
+  void flushOverflow();
+
+  // Completions the kernel had to drop, ever
+  [[nodiscard]] unsigned dropped() const {
+    return std::atomic_ref(*cq_overflow_).load(std::memory_order_relaxed);
+  }
+
+  // Calls 'fn' on every available completion
+  template <typename Fn>
+  size_t reap(Fn&& fn) {
+    size_t reaped = 0;
+    auto head     = *cq_head_;
+    const auto tail =
+        std::atomic_ref(*cq_tail_).load(std::memory_order_acquire);
+    while (head != tail) {
+      fn(cqes_[head & *cq_mask_]);
+      ++head;
+      ++reaped;
+    }
+    std::atomic_ref(*cq_head_).store(head, std::memory_order_release);
+    return reaped;
+  }
+
+ private:
+  void unmap();
+
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+            const void* arg, size_t arg_size);
+
+  int ring_fd_;
+
+  void* sq_ptr_{nullptr};
+  size_t sq_size_{0};
+  void* cq_ptr_{nullptr};
+  size_t cq_size_{0};
+  io_uring_sqe* sqes_{nullptr};
+  size_t sqes_size_{0};
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_entries_;
+  unsigned* sq_array_;
+  unsigned* sq_flags_;
+  // Queued but not yet handed to the kernel
+  unsigned to_submit_{0};
+
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  unsigned* cq_overflow_;
+  io_uring_cqe* cqes_;
+};
+}  // namespace detail
+
+// EventWatcher backed by io_uring instead of epoll.
+//
+// Every watched (fd, flag) pair is a poll request living in the ring,
+// watch changes are queued as submissions rather than applied with
+// epoll_ctl. The doorbell is the eventfd of EventWatcher under one more
+// multishot poll, so a wakeup arrives as a completion. Each loop iteration
+// is a single io_uring_enter that submits all queued changes and waits for
+// completions, bounded by the next timer deadline.
+//
+// Watches are level-triggered as on the epoll loop: a single-shot poll,
+// re-armed after each callback, so a callback that leaves data behind is
+// invoked again. EDGE watches are multishot polls, which report readiness
+// transitions only. ONESHOT uses a single-shot poll that watch re-arms.
+// Tasks, timers, hooks, the task budget, stats and the watchdog work as on
+// the epoll loop; busy poll and event budgets do not apply.
+class UringEventWatcher : public EventWatcher {
+ public:
+  static constexpr unsigned kDefaultEntries = 256;
+
+  explicit UringEventWatcher(unsigned entries = kDefaultEntries);
+  ~UringEventWatcher() override;
+
+  void watch(int fd, WatchFlag flag, WatchCallback callback) override;
+  void unwatch(int fd, WatchFlag flag) override;
+  void unwatchAll() override;
+  void runInEventWatcherLoop(WatchCallback task) override;
+
+ private:
+  using W = std::pair<int, WatchFlag>;
+
+  // Reserved user_data values, poll requests use tokens from kFirstToken
+  static constexpr uint64_t kDoorbellToken = 1;
+  static constexpr uint64_t kIgnoredToken  = 2;
+  static constexpr uint64_t kFirstToken    = 16;
+
+  struct Watch {
+    uint64_t token;
+    WatchCallbackPtr callback;
+    // EDGE and ONESHOT as given to watch, decide the kind of poll
+    WatchFlag modifiers{};
+    // Poll request is pending in the ring
+    bool armed{false};
+  };
+
+  detail::Uring ring_;
+  // Loop thread only, completions the kernel dropped so far
+  unsigned dropped_{0};
+
+  // Loop thread only
+  std::unordered_map<W, Watch, bits::Hash<W>> watches_;
+  std::unordered_map<uint64_t, W> key_by_token_;
+  uint64_t next_token_{kFirstToken};
+
+  void waitLoop();
+  // Waits for completions, or only submits if the loop must not block
+  void wait();
+  void reapAll();
+  void armDoorbell();
+  void armPoll(int fd, WatchFlag flag, Watch& watch);
+  static bool edgeTriggered(const Watch& watch) {
+    return (watch.modifiers & (EDGE | ONESHOT)) == EDGE;
+  }
+  void cancelPoll(uint64_t token);
+  void onCompletion(const io_uring_cqe& cqe);
+};
+
+}  // namespace getrafty::io